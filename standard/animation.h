@@ -0,0 +1,10 @@
+/*
+* generated by tools/animenc from 361 keyframes, do not edit
+*/
+const uint8_t animation[]={
+		0x05,0x03,0x01,0x0b,0x03,0x16,0x0f,0x03,0x02,0x17,0x0f,0x03,
+		0x03,0x17,0x0f,0x03,0x04,0x17,0x0f,0x03,0x05,0x17,0x0f,0x03,
+		0x06,0x17,0x0f,0x03,0x07,0x17,0x0f,0x03,0x08,0x17,0x0f,0x03,
+		0x09,0x17,0x0f,0x03,0x0a,0x17,0x0f,0x03,0x0b,0x17,0x0f,0x03,
+		0x0c,0x17,0x05,0x02,0x0f,0xbb,0x02,0x16,0xbb,0x04,0x17,0xbb,
+		0x08,0x17,0x05,0x4a,0x00,0xf8	};
@@ -0,0 +1,143 @@
+/*******************************************************************************
+* (c) 2024 by Theo Borm
+* see LICENSE file in the root directory of this repository
+*
+*
+* clock.h: clock profile of the tag
+*
+* The first part states the clocks and the timing the firmware is designed
+* for, the second part derives the timer settings and the tock counts from it.
+* Switching to another clock profile only requires changes in the first part.
+* Values that do not fit the timers stop the build with an #error.
+* The host tools in the tools directory include this file as well, so they
+* check a capture or a carrier against the same profile.
+*/
+
+// The IHRC is calibrated to 16MHz. T16 (the ticks) and TM2 (the IR carrier)
+// always run from the IHRC, whatever the system clock is
+#define ihrcfreq 16000000
+// The system clock (the processor) runs from the IHRC divided by sysclockdiv:
+// 1, 2, 4, 8, 16, 32 or 64. A slower system clock uses less power, but the
+// interrupt routine must still fit in a tick
+#define sysclockdiv 2
+// the IHRC is calibrated at this supply voltage (mV) when programming
+#define calibratemv 4000
+
+// tick period in us, every tick one component LED is lit
+#define tickus 488
+// a tock (one frame) takes the 27 ticks of the LED component time phases
+#define tickspertock 27
+
+// the IR receivers are tuned to 38kHz
+#define ircarrier 38000
+// carrier duty: 0 gives a 50% carrier in period mode, 1-63 a duty of irduty/64
+// in 6 bit PWM mode (16 is 25%). PWM mode divides tm2clock by 64*scaler: 35.7kHz
+// at 16MHz, 6% below 38kHz, which costs range with 38kHz receivers
+#define irduty 0
+
+// IR bursts last whole tocks: a pulse irpulsetime tocks plus the pattern (0-2),
+// a burst of a solicitation irsolicittime tocks. A pulse also carries the index
+// (0 to irseeds-1) of its random seed as irseedticks ticks per step
+#define irpulsetime 2
+#define irsolicittime 1
+#define irseeds 3
+#define irseedticks 9
+
+// the mode reverts after 1m without a received pulse
+#define watchdogseconds 60
+// a pulse is transmitted every 55s, this must be shorter than the above
+#define transmitseconds 55
+
+
+/*******************************************************************************
+* derived values, do not change
+*/
+
+// setting for PDK_SET_SYSCLOCK() and the frequency the IHRC is calibrated for
+#if sysclockdiv==1
+#define sysclocksetting SYSCLOCK_IHRC_16MHZ
+#define sysclockfreq 16000000
+#elif sysclockdiv==2
+#define sysclocksetting SYSCLOCK_IHRC_8MHZ
+#define sysclockfreq 8000000
+#elif sysclockdiv==4
+#define sysclocksetting SYSCLOCK_IHRC_4MHZ
+#define sysclockfreq 4000000
+#elif sysclockdiv==8
+#define sysclocksetting SYSCLOCK_IHRC_2MHZ
+#define sysclockfreq 2000000
+#elif sysclockdiv==16
+#define sysclocksetting SYSCLOCK_IHRC_1MHZ
+#define sysclockfreq 1000000
+#elif sysclockdiv==32
+#define sysclocksetting SYSCLOCK_IHRC_500KHZ
+#define sysclockfreq 500000
+#elif sysclockdiv==64
+#define sysclocksetting SYSCLOCK_IHRC_250KHZ
+#define sysclockfreq 250000
+#else
+#error "sysclockdiv must be 1, 2, 4, 8, 16, 32 or 64"
+#endif
+#if sysclockfreq*sysclockdiv != ihrcfreq
+#error "the system clock settings assume a 16MHz IHRC"
+#endif
+
+// T16 counts the IHRC divided by 64 and interrupts when bit 8 toggles, so it
+// is preloaded with 256 minus the number of counts per tick
+#define t16clock (ihrcfreq/64)
+#define t16counts ((t16clock/1000*tickus+500)/1000)
+#define t16preload ((uint8_t)(256-t16counts))
+#if (t16counts<16) || (t16counts>255)
+#error "tickus out of range for T16"
+#endif
+
+// the interrupt routine takes a few hundred cycles of the system clock
+#define tickcycles (sysclockfreq/1000*tickus/1000)
+#if tickcycles<400
+#error "the system clock is too slow for the tick period"
+#endif
+
+// the number of tocks in s seconds, rounded
+#define secondstocks(s) (((s)*t16clock+t16counts*tickspertock/2)/(t16counts*tickspertock))
+
+// the IR watchdog counts units of 32 tocks. The constants used in the code are
+// cast to their variable types, so no 32 bit arithmetic is generated
+#define watchdogunits ((secondstocks(watchdogseconds)+31)/32)
+#define transmittocks secondstocks(transmitseconds)
+#if watchdogunits>254
+#error "watchdogseconds too long for the 8 bit IR watchdog"
+#endif
+#if transmittocks+16 > 32*(watchdogunits-1)
+#error "transmitseconds must be shorter than watchdogseconds"
+#endif
+#define irwatchdogtimeout ((uint8_t)watchdogunits)
+#define transmitirpulseafter ((uint16_t)transmittocks)
+
+// TM2 in period mode toggles PB2 each time its counter passes TM2B, so the
+// carrier is tm2clock/(2*(TM2B+1)*scaler). The settings closest to ircarrier are
+// the smallest scaler for which TM2B fits in 8 bits, then TM2B rounded to the
+// nearest period. tools/carrier shows the remaining error for every clock TM2
+// can run from
+#define tm2clock ihrcfreq
+#define tm2scaler ((tm2clock/(2*ircarrier)+255)/256)
+#define tm2period ((tm2clock+ircarrier*tm2scaler)/(2*ircarrier*tm2scaler))
+#if tm2scaler>32
+#error "tm2clock too fast for the IR carrier, use the TM2 prescaler"
+#endif
+#if tm2period<2
+#error "tm2clock too slow for the IR carrier"
+#endif
+#define tm2pwmscaler ((tm2clock+32*ircarrier)/(64*ircarrier))
+#if irduty>63
+#error "irduty must be 0-63"
+#endif
+#if irduty && (tm2pwmscaler<1 || tm2pwmscaler>32)
+#error "tm2clock out of range for a PWM IR carrier"
+#endif
+
+#if irpulsetime<=irsolicittime
+#error "pulses must be longer than solicitation bursts"
+#endif
+#if irseeds*irseedticks > tickspertock
+#error "the seed index steps must fit in a tock"
+#endif
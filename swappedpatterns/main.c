@@ -25,6 +25,72 @@
 * switches to pattern B. If a tag does NOT receive an IR code for about 60
 * seconds, it switches back to pattern A, otherwise it continues with pattern B
 *
+* Every IR pulse carries the index of a seed. All tags that hear the pulse (and
+* the tag transmitting it) reload their random generator with that seed at the
+* end of the tock in which the pulse ends, so their "random" patterns run in
+* lockstep. The sender uses the seed after the one of the latest pulse it sent
+* or heard. A tag that was not synchronized also restarts its pattern timing
+*
+* A tag that powers up does not wait for the next pulse of its neighbors: it
+* solicits one by sending two short IR bursts of 1 tock. Any synchronized tag
+* that hears such a pair of bursts answers with a normal sync pulse after a
+* short delay with some jitter, so a new tag is synchronized within a few
+* seconds. Only bursts that are shorter than a pulse count as a solicitation,
+* so pulses and answers never trigger answers themselves, and a tag answers
+* at most once per transmit cycle
+*
+* A tag that has not received any IR pulse for about 30 minutes, or that receives
+* the sleep command, goes into a deep sleep: the display and both
+* timers are stopped and the processor runs from the low speed ILRC oscillator,
+* mostly halted. It wakes up (with a reset) when an IR pulse arrives on PA4.
+* The sleep command is a group of four bursts of about 8ms. Tags never send
+* bursts shorter than a tock, so their traffic cannot be taken for it
+*
+* Instead of the 3 RGB LEDs of the patterns, the display can show a framebuffer
+* with a palette color for each of the 24 RGB LEDs for a number of tocks. Every
+* frame the next 3 lit LEDs of the framebuffer are displayed, so up to 3 lit
+* LEDs are shown at the full frame rate; more lit LEDs share the frames and
+* flicker. The framebuffer takes 15 bytes of RAM and is only built in when the
+* animation below uses it
+*
+* The colors of the patterns are faded and dithered: every color component has
+* a level of 0-24 (in 1/8 ticks) that moves one step per tock towards the 2 bit
+* component of the target color, weighted per channel to balance the colors
+* (palette.h).
+* An error-diffusing (sigma-delta) accumulator per component decides every
+* frame if it gets 0, 1, 2 or 3 ticks, so that the average over a few frames
+* matches the level
+*
+* The IR receiver output (PA4) is sampled every tick by the interrupt routine.
+* A pulse is only accepted when PA4 stays low for a number of consecutive ticks.
+* Shorter low periods are counted as noise, and the more noise there is (e.g.
+* from sunlight, fluorescent lamps or remote controls), the longer PA4 has to
+* stay low. The noise estimate decays in about 3 seconds
+*
+* When the start of an IR pulse is seen, the display shows a short white flash
+* of the whole ring, starting at the next tick
+*
+* If useanimation is set to 1, the chaser pattern is replaced by a keyframe
+* animation that is played from a compressed ROM table into the framebuffer.
+* The table (animation.h) is generated from a list of keyframes with the
+* animenc tool in the tools directory of this repository
+*
+* The IR LED takes the largest current peaks of the tag. Setting irduty (in
+* clock.h) drives it with a reduced duty carrier. The carrier tool in the tools directory
+* compares the transmit energy per pulse of the duty settings and the pulse
+* lengths
+*
+* The length of a pulse tells which of 3 chaser patterns the sender shows: 2, 3
+* or 4 tocks for pattern 0, 1 or 2, and the seed index: 0, 9 or 18 ticks more.
+* The interrupt routine measures how long PA4 stays low, and a tag adopts the
+* pattern and the seed of every pulse it receives. A tag that heard nothing
+* during a whole transmit cycle moves on to the next pattern, so a group takes
+* over the pattern of whichever tag reaches it. Solicitations carry neither
+*
+* The main loop runs the IR transmitter, the IR receiver and the power
+* management as separate tasks (stackless protothreads) that are
+* called over and over and wait for tock deadlines without blocking each other
+*
 * Uses a timer T16 interrupt for delays and display timing
 * Uses timer T2 to generate 38Khz IR modulation signal
 *
@@ -32,10 +98,10 @@
 * separate LEDs, for a total of 72 LEDs. Only one of these 72 LEDs will be lit
 * at a time. If we want to make it appear as if 3 separate RGB LEDs are lit
 * with 1 bit per color (for a total of 8 colors including black), then we should
-* sequentially juggle switching on/off 9 LEDs each frame. At 1 tick=0.5ms, this
-* means a "frame rate" of 222 frames/s
+* sequentially juggle switching on/off 9 LEDs each frame, a frame of 9 ticks.
 * If we use 2 bits per color and switch on a LED for either 0, 1, 2 or 3 ticks
-* per frame, we can maintain a frame rates of 74 frames/s with 3 RGB LEDs
+* per frame, a frame takes 27 ticks (one tock) with 3 RGB LEDs. The tick period
+* is set in clock.h, the resulting rates are given in Part 1
 *
 * Every interrupt only one of the component LEDs will be lit, so we have to
 * figure out which one, then retrieve the bitbang values and subsequently
@@ -140,11 +206,12 @@
 #include <stdint.h>
 #include <device.h>
 #include <calibrate.h>
+#include "clock.h"
 
 /*
 * PA3 and PA5 are used as debug status outputs
 */
-volatile uint8_t debugstatus=0;
+volatile uint8_t debugstatus;
 #define SETPA3 0x08
 #define CLEARPA3 0xf7
 #define SETPA6 0x40
@@ -153,20 +220,25 @@ volatile uint8_t debugstatus=0;
 
 /*******************************************************************************
 * configure/calibrate system clock source
+*
+* To get the display running as soon as possible after a reset, the C runtime
+* initialization of global variables is skipped by returning a non-zero value.
+* All global variables are given their initial values in main(), so none of the
+* globals below has an initializer.
 */
 unsigned char _sdcc_external_startup(void)
 {
-	// use the IHRC oscillator, target 8MHz
-	PDK_SET_SYSCLOCK(SYSCLOCK_IHRC_8MHZ);
-	// calibrate for 8MHz operation @ 4000 mVolt
-	EASY_PDK_CALIBRATE_IHRC(8000000,4000);
-	return 0;   // keep SDCC happy
+	// use the IHRC oscillator, divided as set in clock.h (8MHz)
+	PDK_SET_SYSCLOCK(sysclocksetting);
+	// calibrate the IHRC for this system clock @ 4000 mVolt
+	EASY_PDK_CALIBRATE_IHRC(sysclockfreq,calibratemv);
+	return 1;   // skip initialization of global variables, main() does this
 }
 
 
 /*******************************************************************************
 * provide a 16 bit tocks() counter AND controls LED (pattern) timing using T16.
-* Each tick is approximately 0.5ms, every tock is 27 ticks
+* Every tock is 27 ticks, the tick period (tickus) is set in clock.h
 *
 * A large part of the functionality is implemented in in an interrupt. The code
 * for this below consists of four parts:
@@ -195,36 +267,67 @@ const uint8_t pp[]={
 		0x21,0x87,0x68,0x84,0x38,0x81,0x94,0x46,0x95,0x56,0x97,0x67,
 		0x00	};
 
-/*
-* ROM-based color sequence table. while 64 colors are possible, only 12/6 are used
-* B,G.R
-* 0,0,3 0,1,3 0,2,2 0,3,1 0,3,0 1,3,0 2,2,0 3,1,0 3,0,0 3,0,1 2,0,2 1,0,3
-* 0,0,3 0,2,2 0,3,0 2,2,0 3,0,0 2,0,2 
-* */
-const uint8_t colors[]={ 0x03,0x07,0x0a,0x0d,0x0c,0x1c,0x28,0x34,0x30,0x31,0x22,0x13 };
-
-/*const uint8_t colors[]={ 0x03,0x0a,0x0c,0x28,0x30,0x22 };*/
+// the colors of the patterns, the palette of the framebuffer and the color
+// weights are shared with tools/colorbal
+#include "palette.h"
 
-uint8_t colorcount=0;
+uint8_t colorcount;
 
 /*
 * LEDs are controlled using a 2kHz "tick rate". Pattern timing and timeouts are
 * executed at a "tock rate" of 1/27th (the number of LEDComponentTimePhases)
-* 74 Hz. Hence a 1 minute timeout corresponds to a tock counter value of 4444
+* 76 Hz. Hence a 1 minute timeout corresponds to a tock counter value of 4554.
+* The tick period and the timeouts in seconds are set in clock.h
+* The tock counter and the IR watchdog in the interrupt routine are 8 bit
+* counters: the IR watchdog counts in units of 32 tocks, and the tock counter is
+* extended to 16 bits by tocks(). The 16 bit work left in the interrupt routine
+* is the chaser phase accumulators (one 16 bit add per chaser per tock) and the
+* animation stream index. The longest ticks are the ones that load the display
+* from the framebuffer (a scan of up to 24 RGB LEDs, only with useanimation)
+* and the ones that fade and dither the colors of an RGB LED (3 components).
+* The worst case cycle count has not been measured yet
 */
 
 // The following (global) variable keeps track of the mode (pattern to display)
-uint8_t mode=1;
+uint8_t mode;
+// the tock phases of the interrupt routine are offset by the schedule of the
+// mode: 0 for the random pattern, chaserschedule for the chaser pattern
+volatile uint8_t schedule;
+#define chaserschedule 27
 // mode reverts to 1 after 1m timeout without received pulse
-uint16_t irwatchdog=0; 
-// use a watchdog timeout of 1m
-#define irwatchdogtimeout 4444
-// transmit a pulse after ~55s
-#define transmitirpulseafter 4074
-// actual pulse is 27 ms
-#define irpulsetime 2
+volatile uint8_t irwatchdog;
+// the watchdog timeout (irwatchdogtimeout, 143 units of 32 tocks at 1m) and the
+// time after which a pulse is transmitted (transmitirpulseafter, 4174 tocks at
+// 55s) are derived in clock.h. As the first unit of the watchdog ends at the
+// next multiple of 32 tocks, the timeout is up to 31 tocks shorter
+// a pulse is sent as irpulsetime+pattern tocks plus irseedticks ticks for every
+// step of the seed index, 27-62ms. irpulsetime, irseedticks and the
+// solicitation bursts of irsolicittime tocks are set in clock.h
+#define irpulsesymbol (irpulsetime+pattern)
 // and after the pulse, the tag is deaf for 27ms as well
 #define irdeaftime 2
+// a solicitation consists of two bursts of 13.5ms. Bursts are told apart by
+// their length when they end: only bursts longer than irsleepmax ticks and up
+// to irsolicitmax ticks, halfway between a solicitation burst and a pulse,
+// belong to a solicitation
+#define irsolicitmax ((irsolicittime+irpulsetime)*tickspertock/2)
+// bursts starting within 81ms of the first burst belong to the same group
+#define irgroupwindow 6
+// a solicitation is answered after 108ms plus 0..202ms of jitter
+#define iranswerdelay 8
+// a group of 4 bursts of 8ms (16 ticks) commands all tags in range to go into
+// deep sleep. The bursts are accepted up to halfway to a solicitation burst,
+// and as far below 16 ticks. They only qualify when irthreshold is 11 or less
+#define irsleepbursts 4
+#define irsleepticks 16
+#define irsleepmax ((irsleepticks+irsolicittime*tickspertock)/2)
+#define irsleepmin (2*irsleepticks-irsleepmax)
+// go into deep sleep after 30 transmit cycles (~30m) without a received pulse
+#define deepsleepafter 30
+// after a timer wake-up from deep sleep, listen for ~20ms
+#define deepsleeplisten 200
+// a wake-up on PA4 is only accepted if it stays low for a few ms
+#define deepsleepconfirm 30
 
 
 
@@ -234,38 +337,194 @@ volatile uint8_t LedPos[3];
 volatile uint8_t LedCol[3];
 volatile uint8_t LedComTimePhase; // count 0..26
 
+// The following (global) variables and switch deal with the keyframe animation
+// player - See Part 4. The stream format is described in tools/animenc.c
+// It is off by default: it replaces the chaser pattern, and it builds in the
+// framebuffer, whose RAM use has not been checked with 'make sizes' yet
+#define useanimation 0
+#if useanimation
+#include "animation.h"
+uint16_t animidx;    // index of the next record in animation[]
+uint8_t animpos;     // RGB LED that was set by the latest keyframe
+uint8_t animdelta;   // position delta of the current run
+uint8_t animflags;   // header bits [2:0] of the current run
+uint8_t animdur;     // tocks to wait after each keyframe of the current run
+uint8_t animcolor;   // palette index of the current run
+uint8_t animrepeat;  // number of keyframes left in the current run
+uint8_t animwait;    // tocks left until the next keyframe
+#endif
+
+// The following (global) variables deal with the framebuffer. It holds 12
+// bytes, each byte holds the palette indices of 2 RGB LEDs (even LED in the low
+// nibble). The interrupt routine displays it, and the animation draws in it
+// between keyframes - See Part 3. It is only built in when the animation uses
+// it, otherwise its 15 bytes of RAM are left free
+#define useframebuffer useanimation
+#if useframebuffer
+uint8_t fb[12];
+volatile uint8_t fbtocks;  // number of tocks to display the framebuffer, 0=off
+volatile uint8_t fbscan;   // next RGB LED of the framebuffer to consider
+volatile uint8_t fbleft;   // number of RGB LEDs left to consider in this frame
+
+// load the next lit RGB LED of the framebuffer into displayed LED k (0-2)
+#define fbexpand(k) \
+	LedCol[k]=0; \
+	while (fbleft) \
+	{ \
+		fbleft--; \
+		intt=fb[fbscan>>1]; \
+		if (fbscan&1) intt>>=4; \
+		intt&=0x0f; \
+		LedPos[k]=fbscan; \
+		if (fbscan>22) fbscan=0; \
+		else fbscan++; \
+		if (intt) { LedCol[k]=palette[intt]; break; } \
+	}
+#else
+#define fbtocks 0 // the patterns are always displayed
+#endif
+
+// The following (global) variables deal with qualifying the IR receiver output
+// - See Part 3
+volatile uint8_t irlowrun;     // number of consecutive ticks PA4 was low
+volatile uint8_t irnoise;      // estimate of the spurious low activity on PA4
+volatile uint8_t irthreshold;  // number of low ticks that qualifies as a pulse
+volatile uint8_t irqualified;  // set while PA4 is low for irthreshold ticks or more
+volatile uint8_t irburstticks; // length in ticks of the latest qualified low period, 0=none
+// in a quiet room 1ms low qualifies, with a lot of noise up to 10ms is required
+// (must stay below the 27 ticks of a solicitation burst)
+#define irqualmin 2
+#define irqualmax 20
+// every short low period adds this to the noise estimate, which decays by 1 every tock
+#define irnoisestep 16
+
+// The following (global) variables deal with the white flash that is shown
+// when an IR pulse arrives - See Part 3
+volatile uint8_t flashticks; // ticks left to show the flash, 0=off
+volatile uint8_t flashscan;  // component LED (0-71) lit by the flash this tick
+// the flash sweeps all 72 component LEDs 3 times (108 ms)
+#define irflashticks 216
+
+// initial positions and colors of the 3 RGB LEDs, copied by main()
+const uint8_t initLedPos[]={ 0,8,16 };
+const uint8_t initLedCol[]={ 0x03,0x0c,0x30 };
+
 // The following (global) variables and constants deal with the timing of the
 // chaser pattern - See Part 4
- // Three position change counters for three different chasers
-volatile uint8_t LedChaseCount[3];
+ // Three 16 bit phase accumulators for three different chasers. Every tock the
+// rate of a chaser is added to its accumulator, and the chaser changes position
+// when the accumulator overflows, i.e. every 65536/rate tocks. As all rates are
+// below 65280, the high byte of the accumulator goes down exactly when it
+// overflows, so the rate is read from the table only once
+volatile uint16_t LedChasePhase[3];
 // Three color change counter shared between the three different chasers
 volatile uint8_t LedColorCount;
 
-// change position ...s
-#define chaserpositiontargetcount0 113
-#define chaserpositiontargetcount1 11
-#define chaserpositiontargetcount2 9
+// change position every 113 tocks (1.53 s), 11 tocks and 9 tocks
+#define chaserrate0 580
+#define chaserrate1 5958
+#define chaserrate2 7282
+// The chaser pattern (0-2) selects the rates of the three chasers: pattern 0
+// uses the rates above, pattern 1 moves all three every 11 tocks and pattern 2
+// every 57, 38 and 28 tocks
+volatile uint8_t pattern;
+const uint16_t chaserrates[]={ chaserrate0,chaserrate1,chaserrate2,
+		5958,5958,5958, 1160,1740,2320 };
 // change color every 3.42 s
 #define chasercolortargetcount 253
 
+// The following (global) variable and macro deal with fading and dithering the
+// colors of the patterns - See Part 4. For each color component (red, green and
+// blue of LED 0, then LED 1 and LED 2) bits [7:3] hold its level 0-24 and bits
+// [2:0] its dither accumulator
+volatile uint8_t LedFade[9];
+
+// target level of every channel (red, green, blue) for component value 0-3
+const uint8_t colorlevel[]={
+		0,balancedlevel(1,redweight),balancedlevel(2,redweight),balancedlevel(3,redweight),
+		0,balancedlevel(1,greenweight),balancedlevel(2,greenweight),balancedlevel(3,greenweight),
+		0,balancedlevel(1,blueweight),balancedlevel(2,blueweight),balancedlevel(3,blueweight) };
+
+// fade the components of LED k towards color intc, then dither them into LedCol[k]
+#define dither(k) \
+	intq=0; \
+	for (intn=3*k; intn<3*k+3; intn++) \
+	{ \
+		intl=LedFade[intn]>>3; \
+		intt=colorlevel[((intn-3*k)<<2)|(intc&0x03)]; \
+		if (intl<intt) intl++; \
+		else if (intl>intt) intl--; \
+		LedFade[intn]=(LedFade[intn]&0x07)+intl; \
+		intq=(intq>>2)|((LedFade[intn]>>3)<<4); \
+		LedFade[intn]=(LedFade[intn]&0x07)|(intl<<3); \
+		intc>>=2; \
+	} \
+	LedCol[k]=intq
+
 
 // The following (global) variables and macro are used in the random pattern -
-// See Part 4
-volatile uint16_t randomnr=1;
-volatile uint8_t randomposns[]={0,0,0}; // this will be kept filled with random positions
+// See Part 4. The 16 bit random number is kept as two bytes
+volatile uint8_t randomlo;
+volatile uint8_t randomhi;
+volatile uint8_t randomposns[3]; // this will be kept filled with random positions
 
-// first line of this definition makes sure that randomnr is non-zero
+// seeds (low byte, high byte) loaded into the random number by all tags at the
+// end of the tock in which a sync pulse ends. The pulse carries the index
+const uint8_t syncseeds[]={ 0xe1,0xac, 0x5d,0x3b, 0x27,0x9f };
+volatile uint8_t syncindex;   // seed index of the latest pulse sent or received
+// bit 0 is set when a sync pulse has been sent or received, handled (and
+// cleared) at the end of the tock by the interrupt routine. Bit 1 is set at the
+// start of a burst when the tag is not synchronized, and restarts the pattern
+// timing as well
+volatile uint8_t syncrequest;
+
+// 16 bit xorshift (13, 9, 7) done byte by byte, giving the same sequence.
+// first line of this definition makes sure that the random number is non-zero
 #define makerandom \
-	randomnr |= randomnr == 0; \
- 	randomnr ^= (randomnr << 13); \
-	randomnr ^= (randomnr >> 9); \
-	randomnr ^= (randomnr << 7)
+	if (!(randomlo|randomhi)) randomlo=1; \
+	randomhi ^= (randomlo << 5); \
+	randomlo ^= (randomhi >> 1); \
+	intq = (randomhi << 7) | (randomlo >> 1); \
+	randomlo ^= (randomlo << 7); \
+	randomhi ^= intq
+
+// The following 8 bit counter is used to count tocks. It overflows after 3.4s,
+// tocks() extends it to a 16 bit counter that overflows after 14m
+volatile uint8_t elapsedtocks;
+uint8_t tockslow;                // elapsedtocks at the previous call of tocks()
+uint16_t tockcount;              // 16 bit tock count returned by tocks()
 
-// The following 16 bit counter is used to count tocks. overflows after 14m
-volatile uint16_t elapsedtocks=0;
 
+// The main loop runs a number of tasks as protothreads: functions that are
+// called over and over and continue where they left off. A task keeps its position
+// in one state byte, used by a switch statement, so a task cannot yield from
+// within a nested function and local variables do not survive a yield.
+// ptloop() runs the block after it as the endless loop of the task
+#define ptloop(state) switch (state) case 0: while (1)
+// give up the processor until cond holds, n must be unique (1-255) within the task
+#define ptwait(state,n,cond) state=n; case n: if (!(cond)) return
 
-uint16_t previoustocks;          // used in waituntiltocks()
+uint8_t irtxstate;               // protothread state of irtxtask()
+
+// The following variables are used by irtxtask() to send pulses
+uint8_t irdeaf;                  // set while sending, irrxtask() ignores PA4
+uint8_t irsolicits;              // solicitation bursts still to send
+uint8_t irtxlength;              // length in tocks of the burst being sent
+uint8_t irtxticks;               // ticks added to the length of the burst being sent
+uint16_t irtxend;                // tock at which the burst or deaf time ends
+uint16_t irtxat;                 // tock at which to send the next pulse
+
+// The following variables are used by irrxtask() to recognize
+// solicitations (groups of two bursts) and to schedule the answer
+uint16_t irlastlow;              // tock of the latest low sample on PA4
+uint16_t irgroupstart;           // tock at which the current burst group started
+uint8_t irbursts;                // number of solicitation bursts in the current group
+uint8_t irsleeps;                // number of sleep command bursts in the current group
+uint8_t irgroupsynced;           // tag was synchronized when the group started
+uint8_t iranswerpending;         // an answer to a solicitation is scheduled
+uint8_t iranswered;              // a solicitation was answered in this transmit cycle
+uint16_t iranswerat;             // tock at which to send the answer
+uint8_t idlecycles;              // transmit cycles without a received pulse
 
 /******************************************************************************* 
 * Part 2: Interrupt setup
@@ -274,14 +533,17 @@ uint16_t previoustocks;          // used in waituntiltocks()
 * an interrupt when a certain bit (8..15) changes.
 * We assume the IHRC is calibrated to 16MHz, then dividing by 64 will produce
 * a 250 KHz input clock to T16. After 256 clock pulses bit 8 will toggle, which
-* is almost once a millisecond. To make it exactly twice a millisecond, we should
-* preload T16 (which is an up-counter) with the value 134.
-* 
+* is almost once a millisecond. To make a tick of tickus (488us), T16 (which is
+* an up-counter) is preloaded with t16preload: 134, see clock.h.
+* At startup T16 is preloaded with 250 instead, so the first tick (and thus the
+* first lit LED) follows within a few microseconds.
 */
 void setup_ticks() {
 	T16M = (uint8_t)(T16M_CLK_IHRC | T16M_CLK_DIV64 | T16M_INTSRC_8BIT);
-	T16C=134;
+	T16C=250;
 	elapsedtocks=0;
+	tockslow=0;
+	tockcount=0;
 	INTEN |= INTEN_T16;
 }
 
@@ -296,6 +558,10 @@ volatile uint8_t intda;
 volatile uint8_t intca;
 volatile uint8_t intdb;
 volatile uint8_t intcb;
+volatile uint8_t intc;
+volatile uint8_t intl;
+volatile uint8_t intn;
+volatile uint8_t intq;
 
 /*******************************************************************************
 * The interrupt handling code contains Parts 3/4/5, but starts off with a
@@ -306,7 +572,7 @@ void interrupt(void) __interrupt(0)
 	if (INTRQ & INTRQ_T16)
 	{
 		INTRQ &= ~INTRQ_T16; // Mark as processed
-		T16C=134;
+		T16C=t16preload;
 
 /******************************************************************************* 
 * Part 3: Handling LED display timing
@@ -350,6 +616,14 @@ void interrupt(void) __interrupt(0)
 			case 17: if (LedCol[2]&0x20) intt=LedPos[2]+48; break; // blue high bit third LED
 		}
 		
+		// the flash overrides whatever the frame would display this tick
+		if (flashticks)
+		{
+			intt=flashscan;
+			if (flashscan>70) flashscan=0;
+			else flashscan++;
+			flashticks--;
+		}
 		
 		// generate the values to output on port A and B		
 		intda=debugstatus;
@@ -389,136 +663,263 @@ void interrupt(void) __interrupt(0)
 		PBC=intcb;
 		PB=intdb;		
 		
+		// qualify the IR receiver output: count consecutive low ticks, and
+		// count low periods that were too short as noise
+		if ((PA &0x10)==0)
+		{
+			if (irlowrun<255) irlowrun++;
+			if (irlowrun>=irthreshold) irqualified=1;
+		}
+		else
+		{
+			if (irqualified) irburstticks=irlowrun;
+			if (irlowrun && (irlowrun<irthreshold) && (irnoise<(255-irnoisestep))) irnoise+=irnoisestep;
+			irlowrun=0;
+			irqualified=0;
+		}
+		
 		/*
 		* We have handled the display of leds now, for this to work, we still need to increment the phase
 		* Coming here we can also do other stuff that needs to be done at the tock rate (which is 1/27th
 		* of the tick rate. By doing different things in different phases we can spread this work to keep
 		* the amount of work that needs to be done in any one interrupt smaller.
-		* What actually needs to be done partially depends on the mode.
+		* What actually needs to be done partially depends on the mode, so every
+		* mode has its own schedule: the phases of the chaser pattern are offset
+		* by chaserschedule, and the schedule is picked once per tock in phase 26.
+		* The random pattern has no chaser moves. Both run the random generator,
+		* so tags that loaded the same seed stay in step whichever mode they are in.
 		*
-		* phase 0-8: update position of led 0-2
+		* phase 0-2: update position of led 0-2
+		* phase 3: let the IR noise estimate decay and update the IR qualification threshold
+		* phase 4-8: free
 		* phase 9-20: update random numbers
-		* phase 20-25: update color led 0-2
+		* phase 20-25: fade and dither color led 0-2, or load led 0-2 from the framebuffer
 		* phase 26: make sure LedComTimePhase increments to 0 after this
+		*
+		* while the framebuffer is displayed, the positions of the pattern are
+		* not updated
 		*/
 		
 		
-		switch (LedComTimePhase)
+		switch ((uint8_t)(LedComTimePhase+schedule))
 		{
-			case 0: LedChaseCount[0]=LedChaseCount[0]-1; break;
-			case 1: if (LedChaseCount[0]==0)
+			case 0: intn=pattern+pattern+pattern+0;
+				intl=LedChasePhase[0]>>8;
+				LedChasePhase[0]+=chaserrates[intn];
+				if (((uint8_t)(LedChasePhase[0]>>8)<intl) && !fbtocks)
 				{
-					if (mode)
-					{
-						if (LedPos[0]>22) LedPos[0]=0;
-						else LedPos[0]++;
-					}
-					else
-					{
-						LedPos[0]=randomposns[0];
-					}
+					LedPos[0]=randomposns[0];
 				}
 				break;
-			case 2: if (LedChaseCount[0]==0) LedChaseCount[0]=chaserpositiontargetcount0;
+			case 1: intn=pattern+pattern+pattern+1;
+				intl=LedChasePhase[1]>>8;
+				LedChasePhase[1]+=chaserrates[intn];
+				if (((uint8_t)(LedChasePhase[1]>>8)<intl) && !fbtocks)
+				{
+					LedPos[1]=randomposns[1];
+				}
 				break;
-			case 3: LedChaseCount[1]=LedChaseCount[1]-1; break;
-			case 4: if (LedChaseCount[1]==0)
+			case 2: intn=pattern+pattern+pattern+2;
+				intl=LedChasePhase[2]>>8;
+				LedChasePhase[2]+=chaserrates[intn];
+				if (((uint8_t)(LedChasePhase[2]>>8)<intl) && !fbtocks)
 				{
-					if (mode)
-					{
-						if (LedPos[1]<1) LedPos[1]=23;
-						else LedPos[1]--;
-					}
-					else
-					{
-						LedPos[1]=randomposns[1];
-					}
+					LedPos[2]=randomposns[2];
 				}
 				break;
-			case 5: if (LedChaseCount[1]==0) LedChaseCount[1]=chaserpositiontargetcount1;
+			case chaserschedule+0: intn=pattern+pattern+pattern+0;
+				intl=LedChasePhase[0]>>8;
+				LedChasePhase[0]+=chaserrates[intn];
+				if (((uint8_t)(LedChasePhase[0]>>8)<intl) && !fbtocks)
+				{
+					if (LedPos[0]>22) LedPos[0]=0;
+					else LedPos[0]++;
+				}
 				break;
-			case 6: LedChaseCount[2]=LedChaseCount[2]-1; break;
-			case 7: if (LedChaseCount[2]==0)
+			case chaserschedule+1: intn=pattern+pattern+pattern+1;
+				intl=LedChasePhase[1]>>8;
+				LedChasePhase[1]+=chaserrates[intn];
+				if (((uint8_t)(LedChasePhase[1]>>8)<intl) && !fbtocks)
 				{
-					if (mode)
-					{
-						if (LedPos[2]>22) LedPos[2]=0;
-						else LedPos[2]++;
-					}
-					else
-					{
-						LedPos[2]=randomposns[2];
-					}
+					if (LedPos[1]<1) LedPos[1]=23;
+					else LedPos[1]--;
 				}
 				break;
-			case 8: if (LedChaseCount[2]==0) LedChaseCount[2]=chaserpositiontargetcount2;
+			case chaserschedule+2: intn=pattern+pattern+pattern+2;
+				intl=LedChasePhase[2]>>8;
+				LedChasePhase[2]+=chaserrates[intn];
+				if (((uint8_t)(LedChasePhase[2]>>8)<intl) && !fbtocks)
+				{
+					if (LedPos[2]>22) LedPos[2]=0;
+					else LedPos[2]++;
+				}
 				break;
 			
 			
 			
 			
-			case 9:	makerandom;
+			case 3:
+			case chaserschedule+3: if (irnoise) irnoise--;
+				irthreshold=irqualmin+(irnoise>>3);
+				if (irthreshold>irqualmax) irthreshold=irqualmax;
 				break;
-			case 10: if ((randomnr & 0x18) != 0x18)
+			
+			case 9:
+			case chaserschedule+9: makerandom;
+				break;
+			case 10:
+			case chaserschedule+10: if ((randomlo & 0x18) != 0x18)
 				{
-					randomposns[0]=randomnr&0x1f;
+					randomposns[0]=randomlo&0x1f;
 				}
 				break;
-			case 11: makerandom;
+			case 11:
+			case chaserschedule+11: makerandom;
 				break;
-			case 12: if ((randomnr & 0x18) != 0x18)
+			case 12:
+			case chaserschedule+12: if ((randomlo & 0x18) != 0x18)
 				{
-					randomposns[1]=randomnr&0x1f;
+					randomposns[1]=randomlo&0x1f;
 				}
 				break;
-			case 13: makerandom;
+			case 13:
+			case chaserschedule+13: makerandom;
 				break;
-			case 14: if ((randomnr & 0x18) != 0x18)
+			case 14:
+			case chaserschedule+14: if ((randomlo & 0x18) != 0x18)
 				{
-					randomposns[2]=randomnr&0x1f;
+					randomposns[2]=randomlo&0x1f;
 				}
 				break;
-			case 15: makerandom;
+			case 15:
+			case chaserschedule+15: makerandom;
 				 break;
-			case 16: if ((randomnr & 0x18) != 0x18)
+			case 16:
+			case chaserschedule+16: if ((randomlo & 0x18) != 0x18)
 				{
-					randomposns[0]=randomnr&0x1f;
+					randomposns[0]=randomlo&0x1f;
 				}
 				break;
-			case 17: makerandom;
+			case 17:
+			case chaserschedule+17: makerandom;
 				 break;
-			case 18: if ((randomnr & 0x18) != 0x18)
+			case 18:
+			case chaserschedule+18: if ((randomlo & 0x18) != 0x18)
 				{
-					randomposns[1]=randomnr&0x1f;
+					randomposns[1]=randomlo&0x1f;
 				}
 				break;
-			case 19: makerandom;
+			case 19:
+			case chaserschedule+19: makerandom;
 				 break;
-			case 20: if ((randomnr & 0x18) != 0x18)
+			case 20:
+			case chaserschedule+20: if ((randomlo & 0x18) != 0x18)
+				{
+					randomposns[2]=randomlo&0x1f;
+				}
+				break;
+			case chaserschedule+21:
+#if useanimation
+				// play one keyframe of the animation instead of the chasers
+				fbtocks=2; // keep the framebuffer displayed
+				if (animwait) animwait--;
+				if (!animwait)
 				{
-					randomposns[2]=randomnr&0x1f;
+					if (animrepeat) animrepeat--;
+					else
+					{
+						intt=animation[animidx];
+						if (intt==0xf8)
+						{
+							// end of stream, start all over. animenc only
+							// accepts streams that end with all LEDs off, so a
+							// move of the first record clearing LED 0 is harmless
+							animidx=0;
+							animpos=0;
+							intt=animation[0];
+						}
+						animidx++;
+						animdelta=intt>>3;
+						animflags=intt&0x07;
+						animdur=animation[animidx++];
+						if (animflags&0x04) animcolor=animation[animidx++];
+						if (animflags&0x02) animrepeat=animation[animidx++];
+					}
+					if (animflags&0x01)
+					{
+						// move: switch off the previous RGB LED
+						if (animpos&1) fb[animpos>>1]&=0x0f;
+						else fb[animpos>>1]&=0xf0;
+					}
+					animpos+=animdelta;
+					if (animpos>23) animpos-=24;
+					if (animpos&1) fb[animpos>>1]=(fb[animpos>>1]&0x0f)|(animcolor<<4);
+					else fb[animpos>>1]=(fb[animpos>>1]&0xf0)|animcolor;
+					animwait=animdur;
 				}
+#endif
+				// fall through
+			case 21: LedColorCount--;
 				break;
-			case 21: LedColorCount--; break;
-			case 22: if (LedColorCount==0) 
+			case 22:
+			case chaserschedule+22: if (LedColorCount==0) 
 				{
 					LedColorCount=chasercolortargetcount;
 					if (colorcount>10) { colorcount=0; }
 					else { colorcount++; }
 				}
 				break;
-			case 23:  LedCol[0]=colors[colorcount]; break;
-			case 24: if (colorcount<8) { LedCol[1]=colors[colorcount+4]; }
-				else { LedCol[1]=colors[colorcount-8]; }
+			case 23:
+			case chaserschedule+23:
+#if useframebuffer
+				if (fbtocks)
+				{
+					fbleft=24;
+					fbexpand(0);
+				}
+				else
+#endif
+				{
+					intc=colors[colorcount];
+					dither(0);
+				}
+				break;
+			case 24:
+			case chaserschedule+24:
+#if useframebuffer
+				if (fbtocks) { fbexpand(1); }
+				else
+#endif
+				{
+					if (colorcount<8) { intc=colors[colorcount+4]; }
+					else { intc=colors[colorcount-8]; }
+					dither(1);
+				}
 				break;
-			case 25: if (colorcount<4) { LedCol[2]=colors[colorcount+8]; }
-				else { LedCol[2]=colors[colorcount-4]; }
+			case 25:
+			case chaserschedule+25:
+#if useframebuffer
+				if (fbtocks) { fbexpand(2); }
+				else
+#endif
+				{
+					if (colorcount<4) { intc=colors[colorcount+8]; }
+					else { intc=colors[colorcount-4]; }
+					dither(2);
+				}
 				break;
 			case 26:
+			case chaserschedule+26:
+#if useframebuffer
+				if (fbtocks) fbtocks--;
+#endif
 				LedComTimePhase=0xff;
+				// the work schedule of the next tock depends on the mode
+				if (mode) schedule=chaserschedule;
+				else schedule=0;
 				if (irwatchdog<irwatchdogtimeout)
 				{
-					irwatchdog=irwatchdog+1;
+					if (!(elapsedtocks&0x1f)) irwatchdog++;
 					debugstatus |= SETPA6;
 				} 
 				else
@@ -526,6 +927,25 @@ void interrupt(void) __interrupt(0)
 					mode = 1;
 					debugstatus =0; // changing to mode 1 clears PA3 and PA6
 				}
+				if (syncrequest&1)
+				{
+					// reload the random number with the seed of the pulse
+					// in lockstep with all other tags that saw it
+					if (syncrequest&2)
+					{
+						// not synchronized: restart the pattern timing
+						LedChasePhase[0]=0;
+						LedChasePhase[1]=0;
+						LedChasePhase[2]=0;
+					}
+					intn=syncindex+syncindex;
+					randomlo=syncseeds[intn];
+					randomhi=syncseeds[intn+1];
+					randomposns[0]=0;
+					randomposns[1]=0;
+					randomposns[2]=0;
+					syncrequest=0;
+				}
 				elapsedtocks++;
 				break; 
 		}
@@ -540,75 +960,287 @@ void interrupt(void) __interrupt(0)
 
 /*******************************************************************************
 * This function returns the number of tocks since starting the interrupt.
-* 16 bit operations are non-atomic on this 8 bit microcontroller, so we must
-* disable the T16 interrupt and then re-enable it after reading the value
+* The interrupt routine only keeps an 8 bit count, reading it is atomic. The
+* tocks that passed since the previous call are added to a 16 bit count, so
+* tocks() must be called at least every 255 tocks (3.4s), which all waiting
+* loops do
 */
 uint16_t tocks() {
-	INTEN &= ~INTEN_T16;
-	uint16_t current = elapsedtocks;
-	INTEN |= INTEN_T16;
-	return(current);
+	uint8_t current = elapsedtocks;
+	tockcount += (uint8_t)(current-tockslow);
+	tockslow = current;
+	return(tockcount);
 }
 
 /*******************************************************************************
 * This function returns true if the IR watchdog timer has expired without
 * receiving a new pulse
-* 16 bit operations are non-atomic on this 8 bit microcontroller, so we must
-* disable the T16 interrupt and then re-enable it after reading the value
 */
 uint8_t get_irwatchdog_state() {
-	INTEN &= ~INTEN_T16;
-	uint16_t current =irwatchdog;
-	INTEN |= INTEN_T16;
+	uint8_t current =irwatchdog;
 	
-	// this is funky - appears to return true after ~ 1 s instead of 1m
-	// DO NOT USE THIS - solved in a different way
+	// irwatchdog is an 8 bit counter, so this read is atomic
 	return(current>=irwatchdogtimeout);
 }
 
 /*******************************************************************************
 * This function resets the value of the ir watchdog timer to zero
-* 16 bit operations are non-atomic on this 8 bit microcontroller, so we must
-* disable the T16 interrupt and then re-enable it after reading the value
 */
 void reset_irwatchdog() {
-	INTEN &= ~INTEN_T16;
 	irwatchdog=0;
-	INTEN |= INTEN_T16;
 }
 /*******************************************************************************
 * This function presets the value of the ir watchdog timer to a timeout
-* 16 bit operations are non-atomic on this 8 bit microcontroller, so we must
-* disable the T16 interrupt and then re-enable it after reading the value
 */
 void preset_irwatchdog() {
-	INTEN &= ~INTEN_T16;
 	irwatchdog=irwatchdogtimeout;
-	INTEN |= INTEN_T16;
 }
 
 
 /*******************************************************************************
-* waituntiltocks() waits for <time> tocks. During this time the IR detection
-* pin will be monitored if monitor != 0. if the pin is monitored and low,
-* then the 16 bit irwatchdog counter will be reset to 0.
+* irstart() and irstop() switch the 38kHz IR carrier on PB2 on and off
+*/
+/*
+* The carrier (ircarrier) and its duty (irduty) are set in clock.h, which also
+* derives the TM2 settings closest to them: tm2scaler and tm2period for the
+* period mode, tm2pwmscaler for the PWM mode. There is no run-time tuning: TM2,
+* T16 and the system clock all run from the IHRC, so a shifted IHRC cannot be
+* measured against any of them
 */
 
-void waituntiltocks(uint16_t ttt, uint8_t monitor)
+void irstart()
 {
-	uint16_t currenttocks;
-	while (((currenttocks= tocks()) - previoustocks) < ttt)
+	/* we want to generate an ~27 ms long 38kHz sync pulse on PB2 using timer 2
+	* IHRC 16MHz, 16000000/(2*211)=37.915 KHz
+	* TM2C [7:4]=0010 -> select IHRC
+	* TB2C [3:2]=01 -> output on PB2 (00=disable)
+	* TM2C [1] = 0 -> period mode
+	* TM2C [0] = 0 -> do not invert
+	* TM2S [7] = 0 -> 8 bit resolution
+	* TM2S [6:5]=00 -> prescaler 1
+	* TM2S [4:0]=tm2scaler-1 -> scaler 1 at 16MHz
+	* TM2B [7:0] -> tm2period-1 = 210 at 16MHz
+	*/
+	TM2C=0; // stop
+	TM2CT=0; // clear the counter
+#if irduty
+	// TM2C [1] = 1 -> PWM mode, TM2S [7] = 1 -> 6 bit, duty (TM2B+1)/64
+	TM2B=irduty-1;
+	TM2S=0b10000000 | (tm2pwmscaler-1);
+	TM2C=0b00100110; // go!
+#else
+	TM2B=tm2period-1;
+	TM2S=tm2scaler-1;
+	TM2C=0b00100100; // go!
+#endif
+}
+
+void irstop()
+{
+	TM2C=0; // stop PWM
+	PB &= 0xfb; // make sure IR LED is off
+}
+
+/*******************************************************************************
+* deepsleep() stops the display and the timers and halts the processor running
+* from the ILRC. T16 is restarted from the ILRC to wake up about once a minute
+* and listen briefly, and a level change on PA4 wakes up the processor as well.
+* As soon as an IR pulse is seen, the tag is reset and starts up normally.
+* This function does not return
+*/
+void deepsleep()
+{
+	uint8_t n;
+	uint8_t low;
+	
+	__disgint();
+	T16M=0; // stop the display
+	irstop(); // stop the IR carrier
+	PA=0x00; // all LEDs and debug status outputs off
+	PAC=0x00;
+	PB=0x00;
+	PBC=0x04; // keep PB2 (IR LED) driven low
+	PADIER=0x10; // only PA4 (IR receiver) can wake up the processor
+	PBDIER=0x00;
+	PDK_SET_SYSCLOCK(SYSCLOCK_ILRC); // run from the ILRC, IHRC off
+	T16M = (uint8_t)(T16M_CLK_ILRC | T16M_CLK_DIV64 | T16M_INTSRC_15BIT);
+	INTEN = INTEN_T16;
+	while (1)
 	{
-		if (monitor){
+		INTRQ = 0;
+		__stopexe(); // halt until T16 or PA4 wakes us up
+		// listen briefly, wake up for real if PA4 stays low long enough
+		low=0;
+		for (n=0; n<deepsleeplisten; n++)
+		{
 			if ((PA &0x10)==0)
 			{
-				reset_irwatchdog();
-				mode=0;
-				debugstatus|=SETPA3; // changing to mode 0 sets PA3
+				if (++low==deepsleepconfirm) __reset();
+			}
+			else low=0;
+		}
+	}
+}
+
+
+/*******************************************************************************
+* irtxdue() returns the length in tocks of the burst that must be sent now, or 0
+* if there is none, and sets irtxticks to the ticks to add to it. Solicitations
+* at power on go first, then answers to solicitations and finally the pulse
+* that is sent every transmit cycle. The length of a pulse carries the pattern
+* and the next seed index. Answers do not shift the transmit cycle
+*/
+uint8_t irtxdue()
+{
+	uint16_t currenttocks=tocks();
+	
+	if (irsolicits)
+	{
+		irsolicits--;
+		irtxticks=0;
+		return(irsolicittime);
+	}
+	if (iranswerpending && ((int16_t)(currenttocks-iranswerat) >= 0))
+	{
+		iranswerpending=0;
+		if (++syncindex>=irseeds) syncindex=0;
+		irtxticks=syncindex*irseedticks;
+		return(irpulsesymbol);
+	}
+	if ((int16_t)(currenttocks-irtxat) >= 0)
+	{
+		if (++idlecycles >= deepsleepafter) return(0); // powertask() takes over
+		if ((idlecycles>1) && (++pattern>2)) pattern=0; // nothing heard for a whole cycle
+		iranswered=0; // answer the next solicitation again
+		irtxat=currenttocks+irpulsesymbol+irdeaftime+transmitirpulseafter+1;
+		if (++syncindex>=irseeds) syncindex=0;
+		irtxticks=syncindex*irseedticks;
+		return(irpulsesymbol);
+	}
+	return(0);
+}
+
+/*******************************************************************************
+* irtxtask() sends the bursts irtxdue() asks for. A burst starts at the tock
+* irtxdue() sees it is due and lasts whole tocks plus irtxticks ticks.
+* Afterwards the tag stays deaf for irdeaftime tocks (longer when a burst of
+* another tag overlaps the end), and the reception of its own burst is
+* discarded. After a pulse the tag reloads its random generator with the seed
+* the pulse carried, at the same tock as the tags that received it
+*/
+void irtxtask()
+{
+	ptloop(irtxstate)
+	{
+		ptwait(irtxstate,1,(irtxlength=irtxdue()));
+		irdeaf=1;
+		irstart(); // start transmitting an IR pulse
+		irtxend=tocks()+irtxlength;
+		ptwait(irtxstate,2,((int16_t)(tocks()-irtxend) >= 0) && (LedComTimePhase>=irtxticks));
+		irstop(); // stop transmitting the IR pulse
+		// reload the seed together with the tags that received the pulse,
+		// and restart the pattern timing like they do if not synchronized
+		if (irtxlength>=irpulsetime) syncrequest=get_irwatchdog_state() ? 3 : 1;
+		irtxend+=irdeaftime;
+		ptwait(irtxstate,3,(int16_t)(tocks()-irtxend) >= 0); // be deaf a little longer
+		// and until a burst of another tag that overlaps the deaf time ends,
+		// as its start was not seen (unless PA4 is stuck low)
+		ptwait(irtxstate,4,!irqualified || ((int16_t)(tocks()-irtxend) > irgroupwindow));
+		// do not take the own pulse or a burst that was cut off for a received
+		// one, and start counting the groups of bursts over
+		irburstticks=0;
+		irbursts=0;
+		irsleeps=0;
+		if (irqualified) irlastlow=tocks(); // not the start of a burst
+		irdeaf=0;
+	}
+}
+
+/*******************************************************************************
+* irrxtask() monitors the IR pulses qualified by the interrupt routine, except
+* while sending. For every burst the irwatchdog counter will be reset to 0. The
+* length of a pulse gives the pattern and the seed index, and the seed is loaded
+* at the end of the tock in which the pulse ends, like the sender does. The
+* first pulse after being unsynchronized restarts the pattern timing as well.
+* A group of bursts of irsolicittime tocks (up to irsolicitmax ticks) that
+* start within irgroupwindow tocks of each other is a solicitation from a tag
+* that just powered up. If this tag was synchronized, it answers with a sync
+* pulse after iranswerdelay tocks plus some jitter, once per transmit cycle at
+* most. Pulses and answers (irpulsetime tocks or more) end a group.
+* A group of irsleepbursts bursts of irsleepmin-irsleepmax ticks is the sleep
+* command, and puts the tag into deep sleep. Bursts heard before the tag sent
+* a pulse do not count toward a group with bursts heard after it
+*/
+void irrxtask()
+{
+	uint16_t currenttocks;
+	uint8_t length;
+	
+	if (irdeaf) return;
+	currenttocks=tocks();
+	if (irburstticks)
+	{
+		// a burst ended, tell the symbols apart by its length in ticks
+		length=irburstticks;
+		irburstticks=0;
+		if ((length>=irsleepmin) && (length<=irsleepmax)) irsleeps++;
+		else irsleeps=0;
+		if ((length>irsleepmax) && (length<=irsolicitmax)) irbursts++;
+		else irbursts=0;
+		if (length>irsolicitmax)
+		{
+			// a pulse: irpulsetime+pattern tocks plus irseedticks ticks per
+			// step of the seed index, round it to the nearest symbol
+			if (length<irpulsetime*tickspertock) length=0;
+			else length=(length-irpulsetime*tickspertock+irseedticks/2)/irseedticks;
+			if (length<3*irseeds)
+			{
+				pattern=length/irseeds;
+				syncindex=length-irseeds*pattern;
+				syncrequest|=1; // load the seed, like the sender does
 			}
 		}
+		else syncrequest=0; // no seed, and no restart of the pattern timing
+		if ((irbursts==2) && irgroupsynced && !iranswerpending && !iranswered)
+		{
+			// the tock counter differs between tags, so its low bits provide the jitter
+			iranswerat=currenttocks+iranswerdelay+(currenttocks&0x0f);
+			iranswerpending=1;
+			iranswered=1;
+		}
+		if (irsleeps==irsleepbursts) deepsleep();
+	}
+	if (irqualified)
+	{
+		if ((currenttocks-irlastlow) > 1)
+		{
+			// this is the start of a new burst
+			flashticks=irflashticks;
+			if (get_irwatchdog_state()) syncrequest|=2; // restart the pattern timing
+			if ((currenttocks-irgroupstart) > irgroupwindow)
+			{
+				// this burst may be the first of a group, which is
+				// counted when the bursts end and their length is known
+				irgroupstart=currenttocks;
+				irbursts=0;
+				irsleeps=0;
+				irgroupsynced=!get_irwatchdog_state();
+			}
+		}
+		irlastlow=currenttocks;
+		idlecycles=0;
+		reset_irwatchdog();
+		mode=0;
+		debugstatus|=SETPA3; // changing to mode 0 sets PA3
 	}
-    	previoustocks += ttt;
+}
+
+/*******************************************************************************
+* powertask() puts the tag into deep sleep when nobody was around for ~30m
+*/
+void powertask()
+{
+	if (idlecycles >= deepsleepafter) deepsleep();
 }
 
 
@@ -649,6 +1281,8 @@ etcetera
 */
 void main()
 {
+	uint8_t i;
+	
 	// Initialize hardware:
   	// DISABLE pull-ups on PB0-7, PA0, PA7
   	// PA4 is the sync input, which requires the pull-up
@@ -668,58 +1302,79 @@ void main()
   	
 	mode=1;
 	debugstatus=SETPA6; // initial state = PA6 HIGH, PA3 LOW
+	schedule=0; // follows the mode from the second tock on
 	preset_irwatchdog();
 	PA=debugstatus;
 	
- 	// setup the positions and the colors of the three RGB LEDs 
-  	LedPos[0]=0;
-	LedPos[1]=8;
-	LedPos[2]=16;
-	LedCol[0]=0x03;
-	LedCol[1]=0x0c;
-	LedCol[2]=0x30;
-	
-	// setup the led chaser timing variables with differnt values for speed, but changing color at the same pace
-	LedChaseCount[0]=chaserpositiontargetcount0;
-	LedChaseCount[1]=chaserpositiontargetcount1;
-	LedChaseCount[2]=chaserpositiontargetcount2;
+ 	// setup the positions and the colors of the three RGB LEDs and the led
+	// chaser timing variables with differnt values for speed, but changing
+	// color at the same pace
+	for (i=0; i<3; i++)
+	{
+		LedPos[i]=initLedPos[i];
+		LedCol[i]=initLedCol[i];
+		LedChasePhase[i]=0;
+		randomposns[i]=0;
+	}
+	for (i=0; i<9; i++) LedFade[i]=0; // fade in from black
 	LedColorCount=chasercolortargetcount;
+	pattern=0;
+	LedComTimePhase=0;
+	colorcount=0;
+	randomlo=1;
+	randomhi=0;
+	syncindex=0;
+	syncrequest=0;
+#if useframebuffer
+	for (i=0; i<12; i++) fb[i]=0;
+	fbtocks=0;
+	fbscan=0;
+	fbleft=0;
+#endif
+	flashticks=0;
+	flashscan=0;
+	irlowrun=0;
+	irnoise=0;
+	irthreshold=irqualmin;
+	irqualified=0;
+	irburstticks=0;
+#if useanimation
+	animidx=0;
+	animpos=0;
+	animflags=0;
+	animcolor=0;
+	animrepeat=0;
+	animwait=0;
+#endif
 
 	// setup and start the timer (and thus the display)
 	setup_ticks();
 	INTRQ = 0;
 	__engint();                     // Enable global interrupts
 	
-	previoustocks=tocks();
-
+	// the remaining variables are only used by the main loop
+	irlastlow=0;
+	irgroupstart=0;
+	irbursts=0;
+	irsleeps=0;
+	irgroupsynced=0; // not synchronized before the first pulse
+	iranswerpending=0;
+	iranswered=0;
+	idlecycles=0;
+	
+	irdeaf=0;
+	irtxstate=0;
+	// solicit a sync pulse from synchronized neighbors instead of waiting
+	// up to a minute for their next one
+	irsolicits=2;
+	irtxat=tocks()+transmitirpulseafter;
 	
 	
 	while (1)
 	{
-
-		waituntiltocks(transmitirpulseafter,1); // do monitor input
-		// start transmitting an IR pulse
-		/* we want to generate an ~27 ms long 38kHz sync pulse on PB2 using timer 2
-		* IHRC 16MHz, 16000000/422=37.914 KHz
-		* TM2C [7:4]=0010 -> select IHRC
-		* TB2C [3:2]=01 -> output on PB2 (00=disable)
-		* TM2C [1] = 0 -> period mode
-		* TM2C [0] = 0 -> do not invert
-		* TM2S [7] = 0 -> 8 bit resolution
-		* TM2S [6:5]=00 -> prescaler 1
-		* TM2S [4:0]=00000 -> scaler 1
-		* TM2B [7:0] -> 211
-		*/
-		TM2C=0; // stop
-		TM2CT=0;
-		TM2B=211;
-		TM2S=0; // clear the counter
-		TM2C=0b00100100; // go!
-		waituntiltocks(irpulsetime,0); // let it run for ~ 27 ms without monitoring IR input
-		// stop transmitting the IR pulse
-		TM2C=0; // stop PWM
-		PB &= 0xfb; // make sure IR LED is off
-		waituntiltocks(irdeaftime,0); // be deaf for IR pulses a little longer
+		irtxtask();
+		irrxtask();
+		powertask();
 	}
 }
 
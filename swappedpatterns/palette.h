@@ -0,0 +1,54 @@
+/*******************************************************************************
+* (c) 2024 by Theo Borm
+* see LICENSE file in the root directory of this repository
+*
+*
+* palette.h: colors of the tag and the weights that balance them
+*
+* main.c displays these colors, tools/colorbal includes this file as well to
+* derive the weights and report the current of the same colors. Weights that
+* cannot be displayed without merging components stop the build with an
+* #error.
+*/
+
+/*
+* ROM-based color sequence table. while 64 colors are possible, only 12/6 are used
+* B,G.R
+* 0,0,3 0,1,3 0,2,2 0,3,1 0,3,0 1,3,0 2,2,0 3,1,0 3,0,0 3,0,1 2,0,2 1,0,3
+* 0,0,3 0,2,2 0,3,0 2,2,0 3,0,0 2,0,2
+* */
+const uint8_t colors[]={ 0x03,0x07,0x0a,0x0d,0x0c,0x1c,0x28,0x34,0x30,0x31,0x22,0x13 };
+
+/*const uint8_t colors[]={ 0x03,0x0a,0x0c,0x28,0x30,0x22 };*/
+
+/*
+* ROM-based palette for the framebuffer. 0 is off, 1-12 are the colors above,
+* 13-15 are dim, medium and bright white
+*/
+const uint8_t palette[]={ 0x00,
+		0x03,0x07,0x0a,0x0d,0x0c,0x1c,0x28,0x34,0x30,0x31,0x22,0x13,
+		0x15,0x2a,0x3f };
+
+// The red, green and blue LEDs differ in efficiency. A 2 bit color component v
+// fades to level v*weight instead of v*8, so the channels that are brighter
+// than needed for a white balance get less on-time and current. tools/colorbal
+// derives the weights from the datasheet of the LEDs, 8 turns the trimming off.
+// Until the datasheet values of the LEDs on the tag are known, all are 8
+#define redweight 8
+#define greenweight 8
+#define blueweight 8
+// The levels are rounded to whole ticks (multiples of 8). A steady level then
+// gets the same ticks every frame: any fraction of a tick would alternate
+// between frames and flicker at 38Hz or less
+#define balancedlevel(v,weight) ((((v)*(weight)+4)/8)*8)
+// a weight must keep the levels of components 1-3 apart, above 0 and within
+// the 3 ticks a component can be lit. With whole ticks only weights 7-9 pass,
+// and they all give 1, 2 and 3 ticks, so steady colors cannot be trimmed per
+// channel at the resolution of the display
+#define weightok(weight) ((balancedlevel(1,weight)>0) && \
+	(balancedlevel(2,weight)>balancedlevel(1,weight)) && \
+	(balancedlevel(3,weight)>balancedlevel(2,weight)) && \
+	(balancedlevel(3,weight)<=24))
+#if !weightok(redweight) || !weightok(greenweight) || !weightok(blueweight)
+#error "a color weight merges components, see tools/colorbal"
+#endif
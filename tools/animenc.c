@@ -0,0 +1,148 @@
+/*******************************************************************************
+* (c) 2024 by Theo Borm
+* see LICENSE file in the root directory of this repository
+*
+*
+* animenc: host-side encoder for the keyframe animations played by the tag
+*
+* Reads keyframes from stdin, one per line:
+*
+*	<duration> <position> <color> [m]
+*
+* duration: number of tocks (frames, see clock.h) until the next keyframe (1-255, 0 acts as 1)
+* position: RGB LED (0-23) to set
+* color:    palette index (0-15, 0 is off) to set it to
+* m:        "move": switch off the LED that was set by the previous keyframe
+*
+* The last keyframe must leave all LEDs off. The tag restarts the animation
+* from LED 0 with the LEDs as they are, so a stream that ends with LEDs lit
+* would leave them lit, or have the first move switch off LED 0 instead of the
+* last LED. Such a stream is rejected.
+*
+* Empty lines and everything after a '#' are ignored. The encoded stream is
+* written to stdout as a C header that can be included by main.c, the
+* compression ratio is reported on stderr.
+*
+* Stream format, one record per run of keyframes:
+*
+*	header:   [7:3] position delta (0-23, forward around the ring)
+*		  [2]   a color byte follows
+*		  [1]   a repeat byte follows
+*		  [0]   move
+*	duration: tocks to wait after each keyframe of the run
+*	color:    (optional) palette index for this and the following records
+*	repeat:   (optional) number of additional keyframes in the run (1-255)
+*
+* A header of 0xf8 (position delta 31) marks the end of the stream, after which
+* the animation restarts from the beginning. Consecutive keyframes with the
+* same position delta, duration, color and move flag are merged into one run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXSTREAM 65536
+
+static unsigned char stream[MAXSTREAM];
+static int streamlen=0;
+
+static void emit(int b)
+{
+	if (streamlen>=MAXSTREAM)
+	{
+		fprintf(stderr,"animenc: animation too long\n");
+		exit(1);
+	}
+	stream[streamlen++]=(unsigned char)b;
+}
+
+/*
+* the run that is being built: its first keyframe and the number of
+* additional keyframes
+*/
+static int rundelta, runduration, runcolor, runmove, runrepeat, runvalid=0;
+static int streamcolor=-1; // color in effect in the stream so far
+
+static void flushrun(void)
+{
+	int header;
+	
+	if (!runvalid) return;
+	header=(rundelta<<3)|runmove;
+	if (runcolor!=streamcolor) header|=0x04;
+	if (runrepeat) header|=0x02;
+	emit(header);
+	emit(runduration);
+	if (header&0x04) emit(runcolor);
+	if (header&0x02) emit(runrepeat);
+	streamcolor=runcolor;
+	runvalid=0;
+}
+
+int main(void)
+{
+	char line[256];
+	int lineno=0, keyframes=0, position=0, i;
+	int lit[24]={0}; // palette index of every LED after the keyframes so far
+	
+	while (fgets(line,sizeof(line),stdin))
+	{
+		int duration, pos, color, delta, move;
+		char flag[8]="";
+		char *comment=strchr(line,'#');
+		
+		lineno++;
+		if (comment) *comment=0;
+		if (strspn(line," \t\r\n")==strlen(line)) continue;
+		if (sscanf(line,"%d %d %d %7s",&duration,&pos,&color,flag)<3 ||
+			duration<0 || duration>255 || pos<0 || pos>23 ||
+			color<0 || color>15 || (flag[0] && strcmp(flag,"m")))
+		{
+			fprintf(stderr,"animenc: line %d: expected <duration 0-255> <position 0-23> <color 0-15> [m]\n",lineno);
+			return 1;
+		}
+		move=(flag[0]=='m');
+		if (move) lit[position]=0;
+		lit[pos]=color;
+		delta=(pos-position+24)%24;
+		position=pos;
+		keyframes++;
+		
+		if (runvalid && delta==rundelta && duration==runduration &&
+			color==runcolor && move==runmove && runrepeat<255)
+		{
+			runrepeat++;
+			continue;
+		}
+		flushrun();
+		rundelta=delta;
+		runduration=duration;
+		runcolor=color;
+		runmove=move;
+		runrepeat=0;
+		runvalid=1;
+	}
+	for (i=0; i<24; i++)
+	{
+		if (lit[i])
+		{
+			fprintf(stderr,"animenc: LED %d is still lit at the end, the animation must end with all LEDs off\n",i);
+			return 1;
+		}
+	}
+	flushrun();
+	emit(0xf8);
+	
+	printf("/*\n* generated by tools/animenc from %d keyframes, do not edit\n*/\n",keyframes);
+	printf("const uint8_t animation[]={");
+	for (i=0; i<streamlen; i++)
+	{
+		printf("%s0x%02x%s",(i%12)?"":"\n\t\t",stream[i],(i<streamlen-1)?",":"");
+	}
+	printf("\t};\n");
+	
+	fprintf(stderr,"animenc: %d keyframes, %d bytes raw, %d bytes encoded, ratio %.1f:1\n",
+		keyframes,keyframes*3,streamlen,streamlen?(double)(keyframes*3)/streamlen:0.0);
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*******************************************************************************
+* (c) 2024 by Theo Borm
+* see LICENSE file in the root directory of this repository
+*
+*
+* carrier: host-side check of the IR carrier frequency generated by TM2
+*
+* usage: carrier [carrier frequency in Hz [IR LED current in mA [supply in V]]]
+*
+* TM2 in period mode toggles PB2 each time its counter passes TM2B, so the
+* carrier is clock/(2*(TM2B+1)*prescaler*scaler). For every clock TM2 can be
+* run from this reports:
+* -	the settings clock.h derives at compile time (smallest scaler for which
+*	TM2B fits in 8 bits, TM2B rounded to the nearest period) and their error
+* -	the best settings over all prescalers and scalers, to show whether the
+*	compile-time derivation leaves anything on the table
+* -	the carrier when the IHRC is off by 1% or 2%, as it is away from the
+*	voltage and temperature it was calibrated at. This shift cannot be tuned
+*	away at run time, because all timers run from the same IHRC
+*
+* Next it models the transmit energy per pulse for the carrier duty (irduty)
+* settings and the pulse lengths of the 3 patterns (irpulsetime plus
+* the pattern, plus irseedticks ticks per step of the seed index): the LED
+* current (default 100mA) flows while the carrier is high, at the supply
+* voltage (default 3V). The pulse starts just after a tock edge.
+* The average current is for one pulse every transmitirpulseafter tocks (~55s)
+*
+* The clocks, the default carrier and the pulse timing come from the clock
+* profile of the firmware, ../standard/clock.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
+#include "../standard/clock.h"
+
+#define IHRC ((double)ihrcfreq)
+#define TICK (64.0*t16counts/IHRC)
+#define TOCK (TICK*tickspertock)
+#define PULSEINTERVAL transmittocks
+
+struct profile {
+	const char *name;
+	double clock;
+} profiles[]={
+	{ "IHRC (firmware)", IHRC },
+	{ "CLK = IHRC/2", IHRC/2 },
+	{ "CLK = IHRC/4", IHRC/4 },
+	{ "CLK = IHRC/8", IHRC/8 },
+	{ "CLK = IHRC/16", IHRC/16 },
+	{ "ILRC", 55000.0 },
+};
+#define NPROFILES (sizeof(profiles)/sizeof(profiles[0]))
+
+static const int prescalers[]={ 1, 4, 16, 64 };
+
+struct pulse {
+	const char *name;
+	int duty;	// irduty, 0 is 50%
+	int tocks;	// irpulsetime+pattern
+	int ticks;	// seed index times irseedticks
+} pulses[]={
+	{ "50%, pattern 0", 0, irpulsetime, 0 },
+	{ "50%, pattern 1", 0, irpulsetime+1, 0 },
+	{ "50%, pattern 2", 0, irpulsetime+2, 0 },
+	{ "50%, pat. 2, seed 2", 0, irpulsetime+2, (irseeds-1)*irseedticks },
+	{ "33%, pattern 0", 21, irpulsetime, 0 },
+	{ "25%, pattern 0", 16, irpulsetime, 0 },
+	{ "25%, pattern 2", 16, irpulsetime+2, 0 },
+};
+#define NPULSES (sizeof(pulses)/sizeof(pulses[0]))
+
+static double frequency(double clock, int period, int prescaler, int scaler)
+{
+	return clock/(2.0*period*prescaler*scaler);
+}
+
+static double error(double f, double carrier)
+{
+	return 100.0*(f-carrier)/carrier;
+}
+
+int main(int argc, char *argv[])
+{
+	double carrier=ircarrier, current=100.0, supply=3.0, reference=0;
+	unsigned i;
+
+	if (argc>4) {
+		fprintf(stderr,"usage: %s [carrier frequency in Hz [IR LED current in mA [supply in V]]]\n",argv[0]);
+		return 1;
+	}
+	if (argc>1) carrier=atof(argv[1]);
+	if (argc>2) current=atof(argv[2]);
+	if (argc>3) supply=atof(argv[3]);
+	if (carrier<=0 || current<=0 || supply<=0) {
+		fprintf(stderr,"carrier: invalid argument\n");
+		return 1;
+	}
+
+	printf("target carrier %.0f Hz\n\n",carrier);
+	printf("%-16s %-22s %10s %7s   %-22s %10s %7s   %s\n",
+		"clock","clock.h","Hz","error","best","Hz","error","IHRC -2%/-1%/+1%/+2%");
+
+	for (i=0; i<NPROFILES; i++) {
+		double clock=profiles[i].clock;
+		// same integer arithmetic as the tm2scaler and tm2period macros
+		long c=(long)clock, t=(long)carrier;
+		long scaler=(c/(2*t)+255)/256;
+		long period=scaler ? (c+t*scaler)/(2*t*scaler) : 0;
+		double f=0, best=0;
+		int bp=0, bs=0, bk=0, p, s, k;
+		char buf[48];
+
+		printf("%-16s ",profiles[i].name);
+		if (scaler<1 || scaler>32 || period<2 || period>256) {
+			printf("%-22s %10s %7s   ","out of range","","");
+		} else {
+			f=frequency(clock,period,1,scaler);
+			snprintf(buf,sizeof(buf),"TM2B=%ld S=%ld",period-1,scaler);
+			printf("%-22s %10.0f %6.2f%%   ",buf,f,error(f,carrier));
+		}
+
+		for (p=0; p<4; p++) for (s=1; s<=32; s++) for (k=1; k<=256; k++) {
+			double g=frequency(clock,k,prescalers[p],s);
+			if (!bk || fabs(g-carrier)<fabs(best-carrier)) {
+				best=g; bp=prescalers[p]; bs=s; bk=k;
+			}
+		}
+		snprintf(buf,sizeof(buf),"TM2B=%d P=%d S=%d",bk-1,bp,bs);
+		printf("%-22s %10.0f %6.2f%%   ",buf,best,error(best,carrier));
+
+		if (f>0) printf("%.0f/%.0f/%.0f/%.0f",f*0.98,f*0.99,f*1.01,f*1.02);
+		printf("\n");
+	}
+
+	printf("\ntransmit energy per pulse at %.0fmA, %.1fV\n\n",current,supply);
+	printf("%-20s %8s %12s %10s %12s\n","setting","duty","length","energy","average");
+	for (i=0; i<NPULSES; i++) {
+		double duty=pulses[i].duty ? pulses[i].duty/64.0 : 0.5;
+		double length=pulses[i].tocks*TOCK+pulses[i].ticks*TICK;
+		double energy=supply*current*1e-3*duty*length;
+
+		if (!i) reference=energy;
+		printf("%-20s %7.1f%% %9.1f ms %7.2f mJ %9.1f uA  (%.0f%%)\n",
+			pulses[i].name,100*duty,1000*length,1000*energy,
+			1e6*energy/supply/(PULSEINTERVAL*TOCK),100*energy/reference);
+	}
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*******************************************************************************
+* (c) 2024 by Theo Borm
+* see LICENSE file in the root directory of this repository
+*
+*
+* colorbal: host-side color balancing of the tag LEDs
+*
+* usage: colorbal <red> <green> <blue> [<red mA> <green mA> <blue mA>]
+*
+* <red> <green> <blue>: luminous intensity (mcd) of the three LEDs from the
+* datasheet of the RGB LED on the tag, at the current the tag drives them with.
+* There are no defaults: weights from guessed intensities would only shift the
+* colors. The currents (default 5mA each) are only used to report the current.
+*
+* The 2 bit color components of the patterns give every channel the same
+* number of ticks, but the LEDs differ in efficiency, so white and mixed colors
+* are off balance and the efficient LEDs take more current than needed. For a
+* white balance, the luminance of red, green and blue must be in the ratio
+* 0.2126 : 0.7152 : 0.0722 (sRGB, D65). The channel that needs its full on-time
+* to reach its share gets weight 8, the others are trimmed to the fraction (in
+* eighths) that gives the same balance.
+*
+* The firmware rounds the level v*weight of a 2 bit component v to whole ticks
+* (balancedlevel() in palette.h), as a fraction of a tick would flicker at 38Hz
+* or less. A weight that merges components or leaves component 1 dark
+* (weightok()) is reported on stderr and replaced by 8, which the firmware
+* accepts. The currents below use the rounded levels.
+*
+* Printed are the redweight, greenweight and blueweight lines for palette.h and,
+* for every palette entry, the average current of one RGB LED showing it
+* without and with the weights and the current saved. The weights are applied
+* to the colors of the patterns (entries 1-12), so only these count for the
+* average. The framebuffer shows its palette entries without them.
+*
+* The palette, the rounding and the tock come from the firmware, through
+* ../standard/palette.h and ../standard/clock.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
+#include "../standard/clock.h"
+#include "../standard/palette.h"
+
+// a component is lit for 0-3 of the ticks of a tock
+#define TICKSPERTOCK tickspertock
+#define NPALETTE (sizeof(palette)/sizeof(palette[0]))
+#define NCOLORS (sizeof(colors)/sizeof(colors[0]))
+
+static const double luminance[3]={ 0.2126, 0.7152, 0.0722 };
+static const char *channel[3]={ "red", "green", "blue" };
+
+int main(int argc, char *argv[])
+{
+	double intensity[3];
+	double current[3]={ 5, 5, 5 };
+	double need[3], maxneed=0, total=0, totalsaved=0;
+	int weight[3];
+	unsigned i, c;
+
+	if ((argc!=4) && (argc!=7)) {
+		fprintf(stderr,"usage: %s <red> <green> <blue> [<red mA> <green mA> <blue mA>]\n",argv[0]);
+		return 1;
+	}
+	for (c=0; c<3; c++) {
+		intensity[c]=atof(argv[1+c]);
+		if (argc==7) current[c]=atof(argv[4+c]);
+		if ((intensity[c]<=0) || (current[c]<=0)) {
+			fprintf(stderr,"colorbal: invalid argument\n");
+			return 1;
+		}
+	}
+
+	// on-time needed by each channel for a white balance
+	for (c=0; c<3; c++) {
+		need[c]=luminance[c]/intensity[c];
+		if (need[c]>maxneed) maxneed=need[c];
+	}
+	for (c=0; c<3; c++) {
+		weight[c]=(int)floor(8*need[c]/maxneed+0.5);
+		if (!weightok(weight[c])) {
+			fprintf(stderr,"colorbal: %s needs weight %d, its levels %d/%d/%d (1/8 ticks) merge components, using 8\n",
+				channel[c],weight[c],balancedlevel(1,weight[c]),
+				balancedlevel(2,weight[c]),balancedlevel(3,weight[c]));
+			weight[c]=8;
+		}
+	}
+
+	printf("// from: colorbal %.0f %.0f %.0f %.1f %.1f %.1f\n",
+		intensity[0],intensity[1],intensity[2],current[0],current[1],current[2]);
+	for (c=0; c<3; c++) printf("#define %sweight %d\n",channel[c],weight[c]);
+	printf("// levels (1/8 ticks) for component 1-3:");
+	for (c=0; c<3; c++) printf(" %s %d/%d/%d",channel[c],balancedlevel(1,weight[c]),
+		balancedlevel(2,weight[c]),balancedlevel(3,weight[c]));
+	printf("\n");
+
+	printf("\n%-7s %-6s %12s %12s %12s\n","entry","color","unweighted","weighted","saved");
+	for (i=1; i<NPALETTE; i++) {
+		double before=0, after=0;
+
+		for (c=0; c<3; c++) {
+			int v=(palette[i]>>(2*c))&0x03;
+			before+=v*current[c]/TICKSPERTOCK;
+			if (i<=NCOLORS) after+=balancedlevel(v,weight[c])/8.0*current[c]/TICKSPERTOCK;
+			else after+=v*current[c]/TICKSPERTOCK;
+		}
+		if (i<=NCOLORS) {
+			total+=before;
+			totalsaved+=before-after;
+		}
+		printf("%-7u 0x%02x   %9.3f mA %9.3f mA %9.3f mA (%.0f%%)\n",
+			i,palette[i],before,after,before-after,100*(before-after)/before);
+	}
+	printf("\naverage saving over the pattern colors (entries 1-%u): %.0f%%\n",(unsigned)NCOLORS,100*totalsaved/total);
+	return 0;
+}
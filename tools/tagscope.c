@@ -0,0 +1,717 @@
+/*******************************************************************************
+* (c) 2024 by Theo Borm
+* see LICENSE file in the root directory of this repository
+*
+*
+* tagscope: host-side analyzer for logic analyzer captures of a tag
+*
+* usage: tagscope <capture.csv|capture.vcd>
+*
+* Reads a sigrok/PulseView capture in CSV or VCD format and compares it with
+* the timing the firmware is designed for. The capture channels must be named
+* after the pins they are connected to: PA0, PA3, PA4, PA6, PA7, PB0-PB7.
+* Channels that are not present are not analyzed.
+*
+* Alternatively a CSV file can hold port states, with columns named PA, PAC,
+* PB and PBC holding the (hexadecimal) register values, for example from a
+* simulator. Only with port states it is known which pins are driven, so only
+* then the display itself can be analyzed.
+*
+* CSV: lines starting with ';' are comments, a "; Samplerate: <n> <unit>"
+* comment sets the samplerate. The first other line names the columns. If the
+* first column is called "Time" it holds the time in seconds, otherwise the
+* time is derived from the row number and the samplerate.
+* VCD: only single bit wires are used.
+*
+* Reported are:
+* -	the tick period, derived from the moments the interrupt routine writes
+*	the LED pins, and its error relative to the nominal tick period
+* -	the distribution of the delay of each port write relative to a regular
+*	grid of ticks, i.e. the variation of the interrupt latency
+* -	the length (and the symbol it stands for), carrier frequency and duty
+*	cycle of the IR bursts on PB2 and the length of the low pulses of the IR
+*	receiver on PA4
+* -	the fraction of time each LED pin is high
+* and from port states:
+* -	the duty cycle of each of the 72 component LEDs
+* -	the lowest refresh (flicker) frequency of each component LED while it is
+*	lit, ignoring gaps of more than 100ms where the pattern switched it off
+* -	the variation of the duty cycles over the 24 positions for each color
+* -	frames in which an RGB LED is lit only partly, because it was moved or
+*	switched in the middle of a frame, and the rate at which these repeat.
+*	When this happens regularly, e.g. with a chaser that moves every 9 frames,
+*	the ring shows a visible beat
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include "../standard/clock.h"
+
+/*
+* nominal timing of the firmware, from its clock profile: T16 counts t16counts
+* of 64 IHRC cycles per tick, a tock is tickspertock ticks, an IR pulse lasts
+* irpulsetime tocks plus the pattern and irseedticks ticks per step of the seed
+* index, and a solicitation burst irsolicittime tocks. TM2 generates the carrier in period mode, or in PWM mode when irduty
+* is set
+*/
+#define NOMINALTICK (64.0*t16counts/ihrcfreq)
+#define TICKSPERTOCK tickspertock
+#if irduty
+#define IRCARRIER ((double)tm2clock/(64.0*tm2pwmscaler))
+#else
+#define IRCARRIER ((double)tm2clock/(2.0*tm2period*tm2scaler))
+#endif
+
+// port writes by one interrupt are merged if they are less than this apart
+#define WRITEMERGE 20e-6
+// PB2 edges less than this apart belong to the same IR burst
+#define BURSTGAP 200e-6
+// a component LED that is off for longer than this is switched off by the pattern
+#define PATTERNGAP 100e-3
+// refresh frequencies below this are reported as visible flicker
+#define FLICKERLIMIT 70
+
+/*
+* the pins the tag uses, by index
+*/
+#define NPINS 13
+static const char *pinname[NPINS]={ "PA0","PA3","PA4","PA6","PA7",
+	"PB0","PB1","PB2","PB3","PB4","PB5","PB6","PB7" };
+// the pins that drive the charlieplexed LEDs
+static const int ledpin[]={ 0,4,5,6,8,9,10,11,12 };
+#define NLEDPINS 9
+#define PIN_PA4 2
+#define PIN_PB2 7
+
+/*
+* a capture is stored as a list of level changes per pin
+*/
+typedef struct { double t; int v; } change_t;
+typedef struct { change_t *c; int n, max; int initial; int present; } trace_t;
+
+static trace_t trace[NPINS];
+static double tstart=0, tend=0;
+static double tick=NOMINALTICK; // measured by analyzeticks()
+
+/*
+* port states are stored as a list of the component LED (0-71, -1 for none)
+* that is lit from a moment on
+*/
+typedef struct { double t; int led; } state_t;
+static state_t *state=NULL;
+static int nstates=0, maxstates=0;
+
+/*
+* component LED to pin-pair table of main.c, order: 24 red, 24 green, 24 blue.
+* high nibble: the pin that is high, low nibble: the pin that is low
+* 1-7: PB0,PB1,PB3-PB7 8: PA0 9: PA7
+*/
+static const unsigned char pp[72]={
+	0x42,0x24,0x71,0x17,0x41,0x14,0x72,0x27,0x53,0x35,0x93,0x39,
+	0x98,0x89,0x58,0x85,0x28,0x82,0x74,0x47,0x75,0x57,0x96,0x69,
+	0x32,0x25,0x61,0x19,0x31,0x15,0x62,0x29,0x43,0x36,0x73,0x45,
+	0x78,0x12,0x48,0x86,0x18,0x83,0x64,0x49,0x65,0x59,0x76,0x79,
+	0x52,0x23,0x91,0x16,0x51,0x13,0x92,0x26,0x63,0x34,0x54,0x37,
+	0x21,0x87,0x68,0x84,0x38,0x81,0x94,0x46,0x95,0x56,0x97,0x67 };
+static const char *colorname[3]={ "red","green","blue" };
+
+static void addchange(int pin, double t, int v)
+{
+	trace_t *tr=&trace[pin];
+
+	if (!tr->present)
+	{
+		tr->present=1;
+		tr->initial=v;
+		return;
+	}
+	if ((tr->n ? tr->c[tr->n-1].v : tr->initial)==v) return;
+	if (tr->n==tr->max)
+	{
+		tr->max=tr->max ? 2*tr->max : 1024;
+		tr->c=realloc(tr->c,tr->max*sizeof(change_t));
+		if (!tr->c) { fprintf(stderr,"tagscope: out of memory\n"); exit(1); }
+	}
+	tr->c[tr->n].t=t;
+	tr->c[tr->n].v=v;
+	tr->n++;
+}
+
+static int findpin(const char *name)
+{
+	int i;
+
+	for (i=0; i<NPINS; i++) if (!strcasecmp(name,pinname[i])) return i;
+	return -1;
+}
+
+static char *trim(char *s)
+{
+	char *e;
+
+	while (isspace((unsigned char)*s)) s++;
+	e=s+strlen(s);
+	while (e>s && isspace((unsigned char)e[-1])) *--e=0;
+	if (*s=='"' && e>s+1 && e[-1]=='"') { e[-1]=0; s++; }
+	return s;
+}
+
+/*
+* decode the lit component LED from the port registers, -1 if none (or if the
+* pins are not driven as a single pin pair)
+*/
+static int decodeled(int pa, int pac, int pb, int pbc)
+{
+	// pin number (as used in pp[]) of PB0-PB7 and PA0-PA7, 0: not an LED pin
+	static const int pbpin[8]={ 1,2,0,3,4,5,6,7 };
+	static const int papin[8]={ 8,0,0,0,0,0,0,9 };
+	int hi=0, lo=0, n=0, i;
+
+	for (i=0; i<8; i++)
+	{
+		if (pbpin[i] && (pbc>>i&1))
+		{
+			if (pb>>i&1) { hi=hi*16+pbpin[i]; n++; }
+			else lo=lo*16+pbpin[i];
+		}
+		if (papin[i] && (pac>>i&1))
+		{
+			if (pa>>i&1) { hi=hi*16+papin[i]; n++; }
+			else lo=lo*16+papin[i];
+		}
+	}
+	if (n!=1 || lo<1 || lo>9) return -1;
+	for (i=0; i<72; i++) if (pp[i]==(hi<<4|lo)) return i;
+	return -1;
+}
+
+static void addstate(double t, int led)
+{
+	if (nstates && state[nstates-1].led==led) return;
+	if (nstates==maxstates)
+	{
+		maxstates=maxstates ? 2*maxstates : 4096;
+		state=realloc(state,maxstates*sizeof(state_t));
+		if (!state) { fprintf(stderr,"tagscope: out of memory\n"); exit(1); }
+	}
+	state[nstates].t=t;
+	state[nstates].led=led;
+	nstates++;
+}
+
+/*******************************************************************************
+* CSV import
+*/
+static int readcsv(FILE *f)
+{
+	char line[4096];
+	int column[64], ncolumns=0, timecolumn=0, headerseen=0, i;
+	int regcolumn[4]={ -1,-1,-1,-1 }, reg[4];
+	static const char *regname[4]={ "PA","PAC","PB","PBC" };
+	double samplerate=0, t;
+	long row=0;
+
+	while (fgets(line,sizeof(line),f))
+	{
+		if (line[0]==';')
+		{
+			char *p=strstr(line,"Samplerate:");
+			if (p)
+			{
+				char unit[16]="";
+				if (sscanf(p+11,"%lf %15s",&samplerate,unit)>=1)
+				{
+					if (unit[0]=='k' || unit[0]=='K') samplerate*=1e3;
+					else if (unit[0]=='M') samplerate*=1e6;
+					else if (unit[0]=='G') samplerate*=1e9;
+				}
+			}
+			continue;
+		}
+		if (!headerseen)
+		{
+			char *tok=strtok(line,",");
+
+			while (tok && ncolumns<64)
+			{
+				tok=trim(tok);
+				if (ncolumns==0 && !strcasecmp(tok,"Time")) timecolumn=1;
+				for (i=0; i<4; i++) if (!strcasecmp(tok,regname[i])) regcolumn[i]=ncolumns;
+				column[ncolumns++]=findpin(tok);
+				tok=strtok(NULL,",");
+			}
+			headerseen=1;
+			if (!timecolumn && samplerate<=0)
+			{
+				fprintf(stderr,"tagscope: CSV without time column or samplerate\n");
+				return -1;
+			}
+			continue;
+		}
+		{
+			char *tok=strtok(line,",");
+
+			t=row/(samplerate>0 ? samplerate : 1);
+			reg[0]=reg[1]=reg[2]=reg[3]=0;
+			for (i=0; tok && i<ncolumns; i++, tok=strtok(NULL,","))
+			{
+				int r;
+
+				if (i==0 && timecolumn) t=atof(tok);
+				else if (column[i]>=0) addchange(column[i],t,atoi(tok)!=0);
+				for (r=0; r<4; r++) if (regcolumn[r]==i) reg[r]=(int)strtol(tok,NULL,16);
+			}
+			if (regcolumn[0]>=0 && regcolumn[1]>=0 && regcolumn[2]>=0 && regcolumn[3]>=0)
+			{
+				// port states: derive the pin levels, undriven pins read as low
+				// except for the IR receiver input
+				for (i=0; i<8; i++)
+				{
+					char name[4]="PA0";
+					int pa, pb;
+
+					name[2]='0'+i;
+					pa=findpin(name);
+					name[1]='B';
+					pb=findpin(name);
+					if (pa>=0) addchange(pa,t,(reg[0]>>i&1) && ((reg[1]>>i&1) || pa==PIN_PA4));
+					if (pb>=0) addchange(pb,t,(reg[2]>>i&1) && (reg[3]>>i&1));
+				}
+				addstate(t,decodeled(reg[0],reg[1],reg[2],reg[3]));
+			}
+			if (row==0) tstart=t;
+			tend=t;
+			row++;
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* VCD import
+*/
+static int readvcd(FILE *f)
+{
+	char word[256], id[64][16];
+	int pinof[64], nids=0, i, first=1;
+	double timescale=1e-6, t=0;
+
+	while (fscanf(f,"%255s",word)==1)
+	{
+		if (!strcmp(word,"$timescale"))
+		{
+			char unit[16]="";
+			double v=1;
+
+			if (fscanf(f,"%255s",word)==1)
+			{
+				// either "1us" or "1 us"
+				if (sscanf(word,"%lf%15s",&v,unit)<2 && fscanf(f,"%15s",unit)!=1) return -1;
+				if (!strcmp(unit,"s")) timescale=v;
+				else if (!strcmp(unit,"ms")) timescale=v*1e-3;
+				else if (!strcmp(unit,"us")) timescale=v*1e-6;
+				else if (!strcmp(unit,"ns")) timescale=v*1e-9;
+				else if (!strcmp(unit,"ps")) timescale=v*1e-12;
+			}
+		}
+		else if (!strcmp(word,"$var"))
+		{
+			char type[32], ident[16], name[64];
+			int width;
+
+			if (fscanf(f,"%31s %d %15s %63s",type,&width,ident,name)!=4) return -1;
+			if (width==1 && nids<64)
+			{
+				strcpy(id[nids],ident);
+				pinof[nids]=findpin(name);
+				nids++;
+			}
+		}
+		else if (word[0]=='#')
+		{
+			t=atof(word+1)*timescale;
+			if (first) { tstart=t; first=0; }
+			tend=t;
+		}
+		else if (word[0]=='0' || word[0]=='1')
+		{
+			for (i=0; i<nids; i++)
+			{
+				if (!strcmp(word+1,id[i]) && pinof[i]>=0) addchange(pinof[i],t,word[0]=='1');
+			}
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* analysis helpers
+*/
+static int cmpdouble(const void *a, const void *b)
+{
+	double x=*(const double *)a, y=*(const double *)b;
+	return (x>y)-(x<y);
+}
+
+static double percentile(double *v, int n, double p)
+{
+	int i=(int)(p*(n-1)+0.5);
+	return v[i];
+}
+
+/*
+* collect the moments the LED pins are written, merging the changes of one
+* interrupt
+*/
+static double *portwrites(int *count)
+{
+	double *w=NULL;
+	int n=0, max=0, i, j;
+
+	for (i=0; i<NLEDPINS; i++)
+	{
+		trace_t *tr=&trace[ledpin[i]];
+		for (j=0; j<tr->n; j++)
+		{
+			if (n==max)
+			{
+				max=max ? 2*max : 4096;
+				w=realloc(w,max*sizeof(double));
+				if (!w) { fprintf(stderr,"tagscope: out of memory\n"); exit(1); }
+			}
+			w[n++]=tr->c[j].t;
+		}
+	}
+	qsort(w,n,sizeof(double),cmpdouble);
+	for (i=0, j=0; i<n; i++)
+	{
+		if (j==0 || w[i]-w[j-1]>WRITEMERGE) w[j++]=w[i];
+	}
+	*count=j;
+	return w;
+}
+
+static void analyzeticks(void)
+{
+	double *w, sum=0, *d;
+	int n, i, k, ksum=0;
+
+	w=portwrites(&n);
+	if (n<3)
+	{
+		printf("ticks: not enough LED pin changes captured\n");
+		free(w);
+		return;
+	}
+
+	// first estimate from the intervals that are a small number of ticks
+	for (i=1; i<n; i++)
+	{
+		k=(int)((w[i]-w[i-1])/NOMINALTICK+0.5);
+		if (k>=1 && k<=TICKSPERTOCK)
+		{
+			sum+=w[i]-w[i-1];
+			ksum+=k;
+		}
+	}
+	if (!ksum)
+	{
+		printf("ticks: LED pin changes do not match the tick period\n");
+		free(w);
+		return;
+	}
+	tick=sum/ksum;
+	// refine over the whole capture
+	k=(int)((w[n-1]-w[0])/tick+0.5);
+	if (k>0) tick=(w[n-1]-w[0])/k;
+
+	printf("ticks: %d port writes over %.3f s\n",n,w[n-1]-w[0]);
+	printf("ticks: period %.2f us, nominal %.2f us, error %+.2f %%\n",
+		tick*1e6,NOMINALTICK*1e6,(tick/NOMINALTICK-1)*100);
+	printf("ticks: tock %.3f ms, frame rate %.2f fps\n",
+		tick*TICKSPERTOCK*1e3,1/(tick*TICKSPERTOCK));
+
+	// delay of every port write relative to the earliest one on a grid of ticks
+	d=malloc(n*sizeof(double));
+	if (!d) { fprintf(stderr,"tagscope: out of memory\n"); exit(1); }
+	for (i=0; i<n; i++)
+	{
+		double g=(w[i]-w[0])/tick;
+		d[i]=(g-floor(g+0.5))*tick;
+	}
+	qsort(d,n,sizeof(double),cmpdouble);
+	for (i=n-1; i>=0; i--) d[i]-=d[0];
+	printf("latency: relative to the earliest port write, in us: median %.1f, 90%% %.1f, 99%% %.1f, max %.1f\n",
+		percentile(d,n,0.5)*1e6,percentile(d,n,0.9)*1e6,percentile(d,n,0.99)*1e6,d[n-1]*1e6);
+	free(d);
+	free(w);
+}
+
+static void analyzeir(void)
+{
+	trace_t *tr=&trace[PIN_PB2];
+	int i, bursts=0;
+
+	if (tr->present)
+	{
+		i=0;
+		while (i<tr->n)
+		{
+			double start=tr->c[i].t, high=0, lastrise=-1;
+			int edges=0;
+
+			// one burst: PB2 edges less than BURSTGAP apart
+			for (; i<tr->n; i++)
+			{
+				if (edges && tr->c[i].t-tr->c[i-1].t>BURSTGAP) break;
+				if (tr->c[i].v) lastrise=tr->c[i].t;
+				else if (lastrise>=0) high+=tr->c[i].t-lastrise;
+				edges++;
+			}
+			if (edges>2)
+			{
+				double len=tr->c[i-1].t-start;
+				int ticks=(int)(len/NOMINALTICK+0.5);
+				int symbol=ticks<irpulsetime*TICKSPERTOCK ? 0 :
+					(ticks-irpulsetime*TICKSPERTOCK+irseedticks/2)/irseedticks;
+				char kind[32];
+
+				// name the symbol the nearest length stands for, with the
+				// same limits as the firmware
+				if (ticks<=(irsolicittime+irpulsetime)*TICKSPERTOCK/2) {
+					ticks=irsolicittime*TICKSPERTOCK;
+					snprintf(kind,sizeof(kind),"solicitation");
+				} else if (symbol<3*irseeds) {
+					ticks=irpulsetime*TICKSPERTOCK+symbol*irseedticks;
+					snprintf(kind,sizeof(kind),"pattern %d, seed %d",symbol/irseeds,symbol%irseeds);
+				} else snprintf(kind,sizeof(kind),"unknown");
+				bursts++;
+				printf("ir: burst at %.4f s, %.2f ms (%s, nominal %.2f ms), carrier %.0f Hz (nominal %.0f Hz), duty %.0f %%\n",
+					start,len*1e3,kind,ticks*NOMINALTICK*1e3,
+					(edges/2)/len,IRCARRIER,len>0 ? 100*high/len : 0);
+			}
+		}
+		if (!bursts) printf("ir: no IR bursts on PB2\n");
+	}
+
+	tr=&trace[PIN_PA4];
+	if (tr->present)
+	{
+		int level=tr->initial, pulses=0;
+		double fall=-1;
+
+		for (i=0; i<tr->n; i++)
+		{
+			level=tr->c[i].v;
+			if (!level) fall=tr->c[i].t;
+			else if (fall>=0)
+			{
+				printf("ir: receiver low at %.4f s for %.2f ms\n",fall,(tr->c[i].t-fall)*1e3);
+				pulses++;
+				fall=-1;
+			}
+		}
+		if (!pulses) printf("ir: no pulses from the IR receiver on PA4\n");
+	}
+}
+
+static void analyzepins(void)
+{
+	int i, j;
+	double span=tend-tstart;
+
+	if (span<=0) return;
+	for (i=0; i<NLEDPINS; i++)
+	{
+		trace_t *tr=&trace[ledpin[i]];
+		double high=0, t=tstart;
+		int v;
+
+		if (!tr->present) continue;
+		v=tr->initial;
+		for (j=0; j<tr->n; j++)
+		{
+			if (v) high+=tr->c[j].t-t;
+			t=tr->c[j].t;
+			v=tr->c[j].v;
+		}
+		if (v) high+=tend-t;
+		printf("pins: %s high %.2f %% of the time\n",pinname[ledpin[i]],100*high/span);
+	}
+}
+
+/*******************************************************************************
+* display analysis, from port states
+*/
+static void analyzedisplay(void)
+{
+	double ontime[72]={ 0 }, laststart[72], longest[72]={ 0 }, span=tend-tstart;
+	int i, j, c, nticks, nframes, offset, bestoffset=0, bestflags=-1;
+	int *lit, *flagged, flags, gaps[64]={ 0 };
+
+	if (!nstates || span<=0) return;
+
+	// duty cycles and the longest time between two refreshes of a lit LED
+	for (c=0; c<72; c++) laststart[c]=-1;
+	for (i=0; i<nstates; i++)
+	{
+		double end=(i+1<nstates) ? state[i+1].t : tend;
+
+		c=state[i].led;
+		if (c<0) continue;
+		ontime[c]+=end-state[i].t;
+		if (laststart[c]>=0)
+		{
+			double period=state[i].t-laststart[c];
+			if (period<PATTERNGAP && period>longest[c]) longest[c]=period;
+		}
+		laststart[c]=state[i].t;
+	}
+	for (c=0; c<3; c++)
+	{
+		double sum=0, sumsq=0, min=1, max=0, mean, sd, lowest=0;
+		int lowestled=-1;
+
+		for (i=0; i<24; i++)
+		{
+			double duty=ontime[c*24+i]/span;
+			sum+=duty;
+			sumsq+=duty*duty;
+			if (duty<min) min=duty;
+			if (duty>max) max=duty;
+			if (longest[c*24+i]>lowest)
+			{
+				lowest=longest[c*24+i];
+				lowestled=i;
+			}
+		}
+		mean=sum/24;
+		sd=sqrt(fabs(sumsq/24-mean*mean));
+		printf("display: %s duty over 24 LEDs: mean %.3f %%, min %.3f %%, max %.3f %%, variation %.0f %%\n",
+			colorname[c],mean*100,min*100,max*100,mean>0 ? 100*sd/mean : 0);
+		if (lowestled>=0)
+		{
+			printf("display: %s lowest refresh frequency %.1f Hz (L%02d)%s\n",colorname[c],1/lowest,
+				lowestled,(1/lowest<FLICKERLIMIT) ? " VISIBLE FLICKER" : "");
+		}
+	}
+	for (i=0; i<24; i++)
+	{
+		printf("display: L%02d duty red %.3f %% green %.3f %% blue %.3f %%\n",i,
+			100*ontime[i]/span,100*ontime[24+i]/span,100*ontime[48+i]/span);
+	}
+
+	// sample the lit component LED in the middle of every tick
+	nticks=(int)(span/tick);
+	lit=malloc((nticks+1)*sizeof(int));
+	flagged=malloc((nticks/TICKSPERTOCK+1)*sizeof(int));
+	if (!lit || !flagged) { fprintf(stderr,"tagscope: out of memory\n"); exit(1); }
+	for (i=0, j=0; i<nticks; i++)
+	{
+		double t=tstart+(i+0.5)*tick;
+		while (j+1<nstates && state[j+1].t<=t) j++;
+		lit[i]=(state[j].t<=t) ? state[j].led : -1;
+	}
+
+	// find the frame alignment with the fewest partly lit frames, then report
+	for (offset=0; offset<=TICKSPERTOCK; offset++)
+	{
+		int o=(offset<TICKSPERTOCK) ? offset : bestoffset;
+		int prev[24], cur[24], next[24], f;
+
+		nframes=(nticks-o)/TICKSPERTOCK;
+		flags=0;
+		for (f=0; f<nframes; f++)
+		{
+			int pos, k;
+
+			// ticks each RGB LED is lit in frames f-1, f and f+1
+			for (pos=0; pos<24; pos++) prev[pos]=cur[pos]=next[pos]=0;
+			for (k=0; k<3*TICKSPERTOCK; k++)
+			{
+				int tk=o+(f-1)*TICKSPERTOCK+k;
+				if (tk<0 || tk>=nticks || lit[tk]<0) continue;
+				if (k<TICKSPERTOCK) prev[lit[tk]%24]++;
+				else if (k<2*TICKSPERTOCK) cur[lit[tk]%24]++;
+				else next[lit[tk]%24]++;
+			}
+			flagged[f]=0;
+			if (f==0 || f==nframes-1) continue;
+			for (pos=0; pos<24; pos++)
+			{
+				if (cur[pos] && abs(cur[pos]-prev[pos])>=2 && abs(cur[pos]-next[pos])>=2 &&
+					(cur[pos]<prev[pos] || cur[pos]<next[pos]))
+				{
+					flagged[f]=1;
+				}
+			}
+			flags+=flagged[f];
+		}
+		if (offset<TICKSPERTOCK && (bestflags<0 || flags<bestflags))
+		{
+			bestflags=flags;
+			bestoffset=offset;
+		}
+	}
+	if (nframes>0)
+	{
+		int last=-1, common=0;
+
+		for (i=0; i<nframes; i++)
+		{
+			if (!flagged[i]) continue;
+			if (last>=0 && i-last<64) gaps[i-last]++;
+			last=i;
+		}
+		for (i=1; i<64; i++) if (gaps[i]>gaps[common]) common=i;
+		printf("display: %d of %d frames partly lit (%.1f per second)\n",
+			flags,nframes,flags/(nframes*tick*TICKSPERTOCK));
+		if (common && gaps[common]>1)
+		{
+			printf("display: partly lit frames repeat every %d frames, visible beat at %.1f Hz\n",
+				common,1/(common*tick*TICKSPERTOCK));
+		}
+	}
+	free(lit);
+	free(flagged);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	const char *ext;
+	int result;
+
+	if (argc!=2)
+	{
+		fprintf(stderr,"usage: tagscope <capture.csv|capture.vcd>\n");
+		return 1;
+	}
+	f=fopen(argv[1],"r");
+	if (!f)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	ext=strrchr(argv[1],'.');
+	if (ext && !strcasecmp(ext,".vcd")) result=readvcd(f);
+	else result=readcsv(f);
+	fclose(f);
+	if (result)
+	{
+		fprintf(stderr,"tagscope: cannot read %s\n",argv[1]);
+		return 1;
+	}
+
+	printf("capture: %.3f s\n",tend-tstart);
+	analyzeticks();
+	analyzeir();
+	analyzepins();
+	analyzedisplay();
+	return 0;
+}